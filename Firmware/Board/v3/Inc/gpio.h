@@ -74,6 +74,9 @@ void SetGPIO12toUART();
 bool GPIO_subscribe(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin,
     uint32_t pull_up_down,
     void (*callback)(void*), void* ctx);
+bool GPIO_subscribe_edge(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin,
+    uint32_t pull_up_down, uint32_t trigger,
+    void (*callback)(void*), void* ctx);
 void GPIO_unsubscribe(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin);
 void GPIO_set_to_analog(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin);
 
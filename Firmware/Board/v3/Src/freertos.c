@@ -91,6 +91,15 @@ osThreadId usb_irq_thread;
 // Place FreeRTOS heap in core coupled memory for better performance
 __attribute__((section(".ccmram")))
 uint8_t ucHeap[configTOTAL_HEAP_SIZE];
+
+#define USB_IRQ_STACK_SIZE 512 // [words]
+__attribute__((section(".ccmram")))
+static uint32_t usb_irq_thread_stack[USB_IRQ_STACK_SIZE];
+static osStaticThreadDef_t usb_irq_thread_cb;
+
+__attribute__((section(".ccmram")))
+static StackType_t idle_task_stack[configMINIMAL_STACK_SIZE];
+static StaticTask_t idle_task_cb;
 /* USER CODE END Variables */
 osThreadId defaultTaskHandle;
 
@@ -148,10 +157,19 @@ void usb_deferred_interrupt_thread(void * ctx) {
 
 void init_deferred_interrupts(void) {
     // Start USB interrupt handler thread
-    osThreadDef(task_usb_pump, usb_deferred_interrupt_thread, osPriorityAboveNormal, 0, 512);
+    osThreadStaticDef(task_usb_pump, usb_deferred_interrupt_thread, osPriorityAboveNormal, 0, USB_IRQ_STACK_SIZE,
+            usb_irq_thread_stack, &usb_irq_thread_cb);
     usb_irq_thread = osThreadCreate(osThread(task_usb_pump), NULL);
 }
 
+// Memory of the idle task, required with configSUPPORT_STATIC_ALLOCATION
+void vApplicationGetIdleTaskMemory(StaticTask_t** ppxIdleTaskTCBBuffer,
+        StackType_t** ppxIdleTaskStackBuffer, uint32_t* pulIdleTaskStackSize) {
+    *ppxIdleTaskTCBBuffer = &idle_task_cb;
+    *ppxIdleTaskStackBuffer = idle_task_stack;
+    *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+
 /* USER CODE END 4 */
 
 /**
@@ -207,6 +207,15 @@ size_t n_subscriptions = 0;
 bool GPIO_subscribe(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin,
     uint32_t pull_up_down,
     void (*callback)(void*), void* ctx) {
+  return GPIO_subscribe_edge(GPIO_port, GPIO_pin, pull_up_down,
+      GPIO_MODE_IT_RISING, callback, ctx);
+}
+
+// Like GPIO_subscribe, but with a selectable edge.
+// @param trigger: one of GPIO_MODE_IT_RISING, GPIO_MODE_IT_FALLING or GPIO_MODE_IT_RISING_FALLING
+bool GPIO_subscribe_edge(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin,
+    uint32_t pull_up_down, uint32_t trigger,
+    void (*callback)(void*), void* ctx) {
   
   // Register handler (or reuse existing registration)
   // TODO: make thread safe
@@ -232,7 +241,7 @@ bool GPIO_subscribe(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin,
   // Set up GPIO
   GPIO_InitTypeDef GPIO_InitStruct;
   GPIO_InitStruct.Pin = GPIO_pin;
-  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+  GPIO_InitStruct.Mode = trigger;
   GPIO_InitStruct.Pull = pull_up_down;
   HAL_GPIO_Init(GPIO_port, &GPIO_InitStruct);
 
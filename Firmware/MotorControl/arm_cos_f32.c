@@ -29,6 +29,7 @@
 #define ARM_MATH_CM4 // TODO: might change in future board versions
 #include "arm_math.h"
 #include "arm_common_tables.h"
+#include "utils.h"
 /**
  * @ingroup groupFastMath
  */
@@ -68,7 +69,7 @@
  * @return cos(x).
  */
 
-float32_t our_arm_cos_f32(
+RAMFUNC float32_t our_arm_cos_f32(
   float32_t x)
 {
   float32_t cosVal, fract, in;                   /* Temporary variables for input, output */
@@ -30,6 +30,7 @@
 #define ARM_MATH_CM4 // TODO: might change in future board versions
 #include "arm_math.h"
 #include "arm_common_tables.h"
+#include "utils.h"
 
 /**
  * @ingroup groupFastMath
@@ -70,7 +71,7 @@
  * @return  sin(x).
  */
 
-float32_t our_arm_sin_f32(
+RAMFUNC float32_t our_arm_sin_f32(
   float32_t x)
 {
   float32_t sinVal, fract, in;                           /* Temporary variables for input, output */
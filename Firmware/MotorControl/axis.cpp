@@ -28,6 +28,7 @@ Axis::Axis(const AxisHardwareConfig_t& hw_config,
     trap_.axis_ = this;
 
     decode_step_dir_pins();
+    update_step_dir_estimator();
     update_watchdog_settings();
 }
 
@@ -35,6 +36,10 @@ static void step_cb_wrapper(void* ctx) {
     reinterpret_cast<Axis*>(ctx)->step_cb();
 }
 
+static void dir_cb_wrapper(void* ctx) {
+    reinterpret_cast<Axis*>(ctx)->dir_cb();
+}
+
 // @brief Sets up all components of the axis,
 // such as gate driver and encoder hardware.
 void Axis::setup() {
@@ -49,33 +54,117 @@ static void run_state_machine_loop_wrapper(void* ctx) {
 
 // @brief Starts run_state_machine_loop in a new thread
 void Axis::start_thread() {
-    osThreadDef(thread_def, run_state_machine_loop_wrapper, hw_config_.thread_priority, 0, 4*512);
+    osThreadStaticDef(thread_def, run_state_machine_loop_wrapper, hw_config_.thread_priority, 0, stack_size_,
+            thread_stack_, &thread_control_block_);
     thread_id_ = osThreadCreate(osThread(thread_def), this);
     thread_id_valid_ = true;
 }
 
 // @brief Unblocks the control loop thread.
 // This is called from the current sense interrupt handler.
+// Uses a direct task notification, which is cheaper than the CMSIS signals.
 void Axis::signal_current_meas() {
-    if (thread_id_valid_)
-        osSignalSet(thread_id_, M_SIGNAL_PH_CURRENT_MEAS);
+    if (thread_id_valid_) {
+        signal_timestamp_ = htim13.Instance->CNT;
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(thread_id_, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
 }
 
 // @brief Blocks until a current measurement is completed
 // @returns True on success, false otherwise
 bool Axis::wait_for_current_meas() {
-    return osSignalWait(M_SIGNAL_PH_CURRENT_MEAS, PH_CURRENT_MEAS_TIMEOUT).status == osEventSignal;
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(PH_CURRENT_MEAS_TIMEOUT)) == 0)
+        return false;
+
+    // Time since the interrupt, in the clocks used by the motor timing log
+    static const uint32_t clocks_per_cnt = (uint32_t)((float)TIM_1_8_CLOCK_HZ / (float)TIM_APB1_CLOCK_HZ);
+    uint32_t period = htim13.Instance->ARR + 1;
+    uint32_t delta = (htim13.Instance->CNT + period - signal_timestamp_) % period;
+    wakeup_latency_ = clocks_per_cnt * delta;
+    if (wakeup_latency_ > max_wakeup_latency_)
+        max_wakeup_latency_ = wakeup_latency_;
+    return true;
 }
 
 // step/direction interface
 void Axis::step_cb() {
     if (step_dir_active_) {
         GPIO_PinState dir_pin = HAL_GPIO_ReadPin(dir_port_, dir_pin_);
-        float dir = (dir_pin == GPIO_PIN_SET) ? 1.0f : -1.0f;
-        controller_.pos_setpoint_ += dir * config_.counts_per_step;
+        step_counter_steps_ += (dir_pin == GPIO_PIN_SET) ? 1 : -1;
     }
 };
 
+// Direction changes with the hardware step counter: the steps counted so far
+// are booked with the old direction. Step/dir drivers require a setup time of
+// the direction before the next step edge, which covers the interrupt latency.
+void Axis::dir_cb() {
+    uint16_t count = step_counter_read();
+    int16_t delta = (int16_t)(count - step_counter_last_);
+    step_counter_last_ = count;
+    step_counter_steps_ += step_counter_dir_ ? delta : -delta;
+    step_counter_dir_ = HAL_GPIO_ReadPin(dir_port_, dir_pin_) == GPIO_PIN_SET;
+}
+
+// @brief Returns the number of steps since the last call (signed by direction)
+int32_t Axis::read_steps() {
+    uint32_t mask = cpu_enter_critical();
+    int32_t steps = step_counter_steps_;
+    if (step_counter_active_) {
+        uint16_t count = step_counter_read();
+        int16_t delta = (int16_t)(count - step_counter_last_);
+        step_counter_last_ = count;
+        steps += step_counter_dir_ ? delta : -delta;
+    }
+    step_counter_steps_ = 0;
+    cpu_exit_critical(mask);
+    return steps;
+}
+
+// @brief Applies the steps received since the last control loop iteration to
+// the controller setpoints. Called from the control loop.
+// With the step rate estimator, the position setpoint follows the estimated
+// step position, which moves smoothly between steps, and the estimated step
+// rate is used as velocity feed-forward.
+void Axis::update_step_dir() {
+    float delta = (float)read_steps() * config_.counts_per_step;
+    if (!config_.step_dir_interpolation && !config_.step_dir_vel_feed_forward) {
+        controller_.pos_setpoint_ += delta;
+        return;
+    }
+
+    // Only the tracking error is kept, the step position itself would lose
+    // precision on long moves
+    float delta_pred = step_observer_.predict(0.0f);
+    step_pos_err_ += delta - delta_pred;
+    float correction = step_observer_.correct(step_pos_err_);
+    step_pos_err_ -= correction;
+
+    if (config_.step_dir_interpolation) {
+        controller_.pos_setpoint_ += delta_pred + correction;
+    } else {
+        controller_.pos_setpoint_ += delta;
+    }
+    if (config_.step_dir_vel_feed_forward && controller_.config_.control_mode == Controller::CTRL_MODE_POSITION_CONTROL) {
+        // Steps are in position setpoint units, the velocity setpoint is
+        // on the motor side
+        Encoder* pos_encoder = controller_.load_encoder();
+        float gear_ratio = (pos_encoder && pos_encoder != &encoder_) ? controller_.config_.load_gear_ratio : 1.0f;
+        controller_.vel_setpoint_ = step_observer_.vel_estimate_ * gear_ratio;
+    }
+}
+
+// @brief Applies config_.step_dir_bandwidth to the step rate estimator.
+// A bandwidth that is too high for the discrete time approximation is
+// clamped to the highest stable value.
+void Axis::update_step_dir_estimator() {
+    if (!step_observer_.set_bandwidth(Observer::TYPE_PLL, config_.step_dir_bandwidth)) {
+        config_.step_dir_bandwidth = 0.25f * (float)current_meas_hz;
+        step_observer_.set_bandwidth(Observer::TYPE_PLL, config_.step_dir_bandwidth);
+    }
+}
+
 void Axis::load_default_step_dir_pin_config(
         const AxisHardwareConfig_t& hw_config, Config_t* config) {
     config->step_gpio_pin = hw_config.step_gpio_pin;
@@ -114,16 +203,40 @@ void Axis::set_step_dir_active(bool active) {
         GPIO_InitStruct.Pull = GPIO_NOPULL;
         HAL_GPIO_Init(dir_port_, &GPIO_InitStruct);
 
-        // Subscribe to rising edges of the step GPIO
-        GPIO_subscribe(step_port_, step_pin_, GPIO_PULLDOWN,
-                step_cb_wrapper, this);
+        step_counter_steps_ = 0;
+        step_observer_.vel_estimate_ = 0.0f;
+        step_pos_err_ = 0.0f;
+
+        if (config_.step_dir_use_timer && step_counter_start(config_.step_gpio_pin)) {
+            // Count the steps in hardware, only direction changes cause an interrupt
+            step_counter_last_ = step_counter_read();
+            step_counter_dir_ = HAL_GPIO_ReadPin(dir_port_, dir_pin_) == GPIO_PIN_SET;
+            GPIO_subscribe_edge(dir_port_, dir_pin_, GPIO_NOPULL,
+                    GPIO_MODE_IT_RISING_FALLING, dir_cb_wrapper, this);
+            step_counter_active_ = true;
+        } else {
+            // Subscribe to rising edges of the step GPIO
+            GPIO_subscribe(step_port_, step_pin_, GPIO_PULLDOWN,
+                    step_cb_wrapper, this);
+        }
 
         step_dir_active_ = true;
     } else {
         step_dir_active_ = false;
 
-        // Unsubscribe from step GPIO
-        GPIO_unsubscribe(step_port_, step_pin_);
+        // Don't leave the last step rate behind as velocity feed-forward
+        if (config_.step_dir_vel_feed_forward)
+            controller_.vel_setpoint_ = 0.0f;
+        step_observer_.vel_estimate_ = 0.0f;
+
+        if (step_counter_active_) {
+            step_counter_active_ = false;
+            GPIO_unsubscribe(dir_port_, dir_pin_);
+            step_counter_stop();
+        } else {
+            // Unsubscribe from step GPIO
+            GPIO_unsubscribe(step_port_, step_pin_);
+        }
     }
 }
 
@@ -259,7 +372,12 @@ bool Axis::run_sensorless_control_loop() {
 
 bool Axis::run_closed_loop_control_loop() {
     // To avoid any transient on startup, we intialize the setpoint to be the current position
-    controller_.pos_setpoint_ = encoder_.pos_estimate_;
+    Encoder* load_encoder = controller_.load_encoder();
+    if (!load_encoder) {
+        controller_.set_error(Controller::ERROR_INVALID_LOAD_ENCODER);
+        return false;
+    }
+    controller_.pos_setpoint_ = load_encoder->pos_estimate_;
     set_step_dir_active(config_.enable_step_dir);
     run_control_loop([this](){
         // Note that all estimators are updated in the loop prefix in run_control_loop
@@ -275,6 +393,149 @@ bool Axis::run_closed_loop_control_loop() {
     return check_for_errors();
 }
 
+static void homing_edge_cb_wrapper(void* ctx) {
+    reinterpret_cast<Axis*>(ctx)->homing_edge_cb();
+}
+
+// @brief Latches the encoder count on an endstop or index edge.
+// This is called from the GPIO interrupt.
+void Axis::homing_edge_cb() {
+    if (homing_capture_armed_) {
+        homing_captured_count_ = encoder_.capture_linear_count();
+        homing_capture_armed_ = false;
+        homing_captured_ = true;
+    }
+}
+
+/*
+ * Homing sequence:
+ *  - If the axis starts on the endstop, back off first.
+ *  - Search the endstop at homing.vel and latch the count at the switch edge.
+ *  - Optionally back off and approach again at homing.slow_vel, which gives
+ *    a more repeatable edge.
+ *  - Optionally continue to the next index pulse and latch the count there.
+ * The linear count is then shifted such that the latched edge is at
+ * homing.home_position. The current is limited to homing.current_lim
+ * throughout, and the controller's control mode is restored at the end.
+ */
+bool Axis::run_homing() {
+    const HomingConfig_t& cfg = config_.homing;
+    is_homed_ = false;
+    if (cfg.endstop_gpio_pin < 1 || cfg.endstop_gpio_pin > GPIO_COUNT || cfg.vel == 0.0f ||
+        !(cfg.current_lim > 0.0f) || !(cfg.backoff_distance > 0.0f) ||
+        controller_.load_encoder() != &encoder_) {
+        error_ |= ERROR_HOMING_FAILED;
+        return false;
+    }
+
+    GPIO_TypeDef* endstop_port = get_gpio_port_by_pin(cfg.endstop_gpio_pin);
+    uint16_t endstop_pin = get_gpio_pin_by_pin(cfg.endstop_gpio_pin);
+    GPIO_subscribe_edge(endstop_port, endstop_pin,
+            cfg.endstop_active_low ? GPIO_PULLUP : GPIO_PULLDOWN,
+            cfg.endstop_active_low ? GPIO_MODE_IT_FALLING : GPIO_MODE_IT_RISING,
+            homing_edge_cb_wrapper, this);
+    GPIO_PinState active_level = cfg.endstop_active_low ? GPIO_PIN_RESET : GPIO_PIN_SET;
+    float dir = (cfg.vel > 0.0f) ? 1.0f : -1.0f;
+
+    Controller::ControlMode_t control_mode = controller_.config_.control_mode;
+    bool vel_ramp_enable = controller_.vel_ramp_enable_;
+    controller_.vel_ramp_enable_ = false;
+    controller_.pos_setpoint_ = encoder_.pos_estimate_;
+    controller_.vel_setpoint_ = 0.0f;
+    controller_.current_setpoint_ = 0.0f;
+    controller_.vel_integrator_current_ = 0.0f;
+    // Limit the current in the controller, so that the velocity integrator
+    // doesn't wind up against the endstop
+    controller_.current_lim_ = cfg.current_lim;
+
+    // Same as the closed loop control loop, but with the homing current limit
+    auto control_step = [&]() {
+        float current_setpoint;
+        if (!controller_.update(encoder_.pos_estimate_, encoder_.vel_estimate_, &current_setpoint))
+            return error_ |= ERROR_CONTROLLER_FAILED, false;
+        float phase_vel = 2*M_PI * encoder_.vel_estimate_ / (float)encoder_.config_.cpr * motor_.config_.pole_pairs;
+        return motor_.update(current_setpoint, encoder_.phase_, phase_vel);
+    };
+
+    // Moves at constant velocity until an edge is latched
+    auto run_until_captured = [&](float vel) {
+        float start_pos = encoder_.pos_estimate_;
+        homing_captured_ = false;
+        homing_capture_armed_ = true;
+        controller_.config_.control_mode = Controller::CTRL_MODE_VELOCITY_CONTROL;
+        controller_.vel_setpoint_ = vel;
+        run_control_loop([&](){
+            if (!control_step())
+                return false;
+            if (fabsf(encoder_.pos_estimate_ - start_pos) > cfg.max_distance)
+                return error_ |= ERROR_HOMING_FAILED, false;
+            return !homing_captured_;
+        });
+        homing_capture_armed_ = false;
+        return homing_captured_ && check_for_errors();
+    };
+
+    // Moves away from the endstop with a trajectory and checks that it was released
+    auto backoff = [&](float from_pos) {
+        controller_.pos_setpoint_ = encoder_.pos_estimate_;
+        controller_.move_to_pos(from_pos - dir * cfg.backoff_distance);
+        run_control_loop([&](){
+            if (!control_step())
+                return false;
+            return controller_.config_.control_mode == Controller::CTRL_MODE_TRAJECTORY_CONTROL;
+        });
+        if (!check_for_errors() || controller_.config_.control_mode == Controller::CTRL_MODE_TRAJECTORY_CONTROL)
+            return false;
+        if (HAL_GPIO_ReadPin(endstop_port, endstop_pin) == active_level)
+            return error_ |= ERROR_HOMING_FAILED, false;
+        return true;
+    };
+
+    bool ok = true;
+    if (HAL_GPIO_ReadPin(endstop_port, endstop_pin) == active_level) {
+        homing_state_ = HOMING_STATE_BACKOFF;
+        ok = backoff(encoder_.pos_estimate_);
+    }
+    if (ok) {
+        homing_state_ = HOMING_STATE_SEARCH;
+        ok = run_until_captured(cfg.vel);
+    }
+    if (ok && cfg.slow_vel != 0.0f) {
+        homing_state_ = HOMING_STATE_BACKOFF;
+        ok = backoff((float)homing_captured_count_);
+        if (ok) {
+            homing_state_ = HOMING_STATE_APPROACH;
+            ok = run_until_captured(dir * fabsf(cfg.slow_vel));
+        }
+    }
+    GPIO_unsubscribe(endstop_port, endstop_pin);
+
+    if (ok && cfg.use_index) {
+        homing_state_ = HOMING_STATE_INDEX;
+        GPIO_subscribe(encoder_.hw_config_.index_port, encoder_.hw_config_.index_pin, GPIO_PULLDOWN,
+                homing_edge_cb_wrapper, this);
+        ok = run_until_captured(dir * fabsf((cfg.slow_vel != 0.0f) ? cfg.slow_vel : cfg.vel));
+        GPIO_unsubscribe(encoder_.hw_config_.index_port, encoder_.hw_config_.index_pin);
+        encoder_.set_idx_subscribe(); // restore the encoder's own index subscription
+    }
+
+    if (ok) {
+        // Shift the position such that the latched edge is at home_position
+        int32_t delta = (int32_t)lroundf(cfg.home_position) - homing_captured_count_;
+        encoder_.set_linear_count(encoder_.shadow_count_ + delta);
+        is_homed_ = true;
+    }
+
+    homing_state_ = HOMING_STATE_INACTIVE;
+    controller_.current_lim_ = 0.0f;
+    controller_.config_.control_mode = control_mode;
+    controller_.vel_ramp_enable_ = vel_ramp_enable;
+    controller_.pos_setpoint_ = encoder_.pos_estimate_;
+    controller_.vel_setpoint_ = 0.0f;
+    controller_.current_setpoint_ = 0.0f;
+    return ok;
+}
+
 bool Axis::run_idle_loop() {
     // run_control_loop ignores missed modulation timing updates
     // if and only if we're in AXIS_STATE_IDLE
@@ -288,17 +549,6 @@ bool Axis::run_idle_loop() {
 // Infinite loop that does calibration and enters main control loop as appropriate
 void Axis::run_state_machine_loop() {
 
-    // Allocate the map for anti-cogging algorithm and initialize all values to 0.0f
-    // TODO: Move this somewhere else
-    // TODO: respect changes of CPR
-    int encoder_cpr = encoder_.config_.cpr;
-    controller_.anticogging_.cogging_map = (float*)malloc(encoder_cpr * sizeof(float));
-    if (controller_.anticogging_.cogging_map != NULL) {
-        for (int i = 0; i < encoder_cpr; i++) {
-            controller_.anticogging_.cogging_map[i] = 0.0f;
-        }
-    }
-
     // arm!
     motor_.arm();
     
@@ -313,6 +563,8 @@ void Axis::run_state_machine_loop() {
                     task_chain_[pos++] = AXIS_STATE_ENCODER_INDEX_SEARCH;
                 if (config_.startup_encoder_offset_calibration)
                     task_chain_[pos++] = AXIS_STATE_ENCODER_OFFSET_CALIBRATION;
+                if (config_.startup_homing)
+                    task_chain_[pos++] = AXIS_STATE_HOMING;
                 if (config_.startup_closed_loop_control)
                     task_chain_[pos++] = AXIS_STATE_CLOSED_LOOP_CONTROL;
                 else if (config_.startup_sensorless_control)
@@ -320,6 +572,8 @@ void Axis::run_state_machine_loop() {
                 task_chain_[pos++] = AXIS_STATE_IDLE;
             } else if (requested_state_ == AXIS_STATE_FULL_CALIBRATION_SEQUENCE) {
                 task_chain_[pos++] = AXIS_STATE_MOTOR_CALIBRATION;
+                if (encoder_.config_.mode == Encoder::MODE_SINCOS)
+                    task_chain_[pos++] = AXIS_STATE_ENCODER_SINCOS_CALIBRATION;
                 if (encoder_.config_.use_index)
                     task_chain_[pos++] = AXIS_STATE_ENCODER_INDEX_SEARCH;
                 task_chain_[pos++] = AXIS_STATE_ENCODER_OFFSET_CALIBRATION;
@@ -366,6 +620,12 @@ void Axis::run_state_machine_loop() {
                 status = encoder_.run_offset_calibration();
             } break;
 
+            case AXIS_STATE_ENCODER_SINCOS_CALIBRATION: {
+                if (!motor_.is_calibrated_)
+                    goto invalid_state_label;
+                status = encoder_.run_sincos_calibration();
+            } break;
+
             case AXIS_STATE_LOCKIN_SPIN: {
                 if (!motor_.is_calibrated_ || motor_.config_.direction==0)
                     goto invalid_state_label;
@@ -392,6 +652,22 @@ void Axis::run_state_machine_loop() {
                 status = run_closed_loop_control_loop();
             } break;
 
+            case AXIS_STATE_AUTOTUNE: {
+                if (!motor_.is_calibrated_ || motor_.config_.direction==0)
+                    goto invalid_state_label;
+                if (!encoder_.is_ready_)
+                    goto invalid_state_label;
+                status = controller_.run_autotune();
+            } break;
+
+            case AXIS_STATE_HOMING: {
+                if (!motor_.is_calibrated_ || motor_.config_.direction==0)
+                    goto invalid_state_label;
+                if (!encoder_.is_ready_)
+                    goto invalid_state_label;
+                status = run_homing();
+            } break;
+
             case AXIS_STATE_IDLE: {
                 run_idle_loop();
                 status = motor_.arm(); // done with idling - try to arm the motor
@@ -21,6 +21,7 @@ public:
         ERROR_CONTROLLER_FAILED = 0x200,
         ERROR_POS_CTRL_DURING_SENSORLESS = 0x400,
         ERROR_WATCHDOG_TIMER_EXPIRED = 0x800,
+        ERROR_HOMING_FAILED = 0x1000, //<! invalid homing config, endstop not found within homing.max_distance or not released
     };
 
     enum State_t {
@@ -35,6 +36,9 @@ public:
         AXIS_STATE_CLOSED_LOOP_CONTROL = 8,  //<! run closed loop control
         AXIS_STATE_LOCKIN_SPIN = 9,       //<! run lockin spin
         AXIS_STATE_ENCODER_DIR_FIND = 10,
+        AXIS_STATE_ENCODER_SINCOS_CALIBRATION = 11, //<! run SinCos encoder signal calibration
+        AXIS_STATE_AUTOTUNE = 12,           //<! identify the load and tune the controller gains
+        AXIS_STATE_HOMING = 13,             //<! find the endstop (and index) and set the home position
     };
 
     struct LockinConfig_t {
@@ -49,16 +53,34 @@ public:
         bool finish_on_enc_idx = false;
     };
 
+    struct HomingConfig_t {
+        uint16_t endstop_gpio_pin = 0;   // GPIO number of the endstop switch, 0 for none
+        bool endstop_active_low = false; // false: switch closes to 3.3V (pull-down), true: switch closes to GND (pull-up)
+        float vel = -2000.0f;            // [counts/s] search velocity, the sign selects the direction towards the endstop
+        float slow_vel = 200.0f;         // [counts/s] velocity of the second approach, 0 to skip it
+        float current_lim = 5.0f;        // [A]
+        float backoff_distance = 500.0f; // [counts]
+        float max_distance = 1000000.0f; // [counts] fail if the endstop is not found within this distance
+        bool use_index = false;          // home on the first index pulse after the endstop
+        float home_position = 0.0f;      // [counts] position assigned to the endstop (or index) edge
+    };
+
     struct Config_t {
         bool startup_motor_calibration = false;   //<! run motor calibration at startup, skip otherwise
         bool startup_encoder_index_search = false; //<! run encoder index search after startup, skip otherwise
                                                 // this only has an effect if encoder.config.use_index is also true
         bool startup_encoder_offset_calibration = false; //<! run encoder offset calibration after startup, skip otherwise
+        bool startup_homing = false; //<! run homing after calibration/startup
         bool startup_closed_loop_control = false; //<! enable closed loop control after calibration/startup
         bool startup_sensorless_control = false; //<! enable sensorless control after calibration/startup
         bool enable_step_dir = false; //<! enable step/dir input after calibration
                                     //   For M0 this has no effect if enable_uart is true
         float counts_per_step = 2.0f;
+        bool step_dir_use_timer = false; //<! count the steps with a hardware timer instead of an interrupt per step
+                                        //   only supported on GPIO3 and GPIO4
+        bool step_dir_interpolation = false;   //<! move the position setpoint smoothly between steps
+        bool step_dir_vel_feed_forward = false; //<! use the estimated step rate as velocity setpoint
+        float step_dir_bandwidth = 200.0f;     //<! [rad/s] bandwidth of the step rate estimator
 
         float watchdog_timeout = 0.0f; // [s] (0 disables watchdog)
 
@@ -67,10 +89,15 @@ public:
         uint16_t dir_gpio_pin = 0;
 
         LockinConfig_t lockin;
+        HomingConfig_t homing;
     };
 
-    enum thread_signals {
-        M_SIGNAL_PH_CURRENT_MEAS = 1u << 0
+    enum HomingState_t {
+        HOMING_STATE_INACTIVE,
+        HOMING_STATE_SEARCH,
+        HOMING_STATE_BACKOFF,
+        HOMING_STATE_APPROACH,
+        HOMING_STATE_INDEX,
     };
 
     enum LockinState_t {
@@ -94,6 +121,10 @@ public:
     bool wait_for_current_meas();
 
     void step_cb();
+    void dir_cb();
+    int32_t read_steps();
+    void update_step_dir();
+    void update_step_dir_estimator();
     void set_step_dir_active(bool enable);
     void decode_step_dir_pins();
     void update_watchdog_settings();
@@ -179,6 +210,8 @@ public:
     bool run_lockin_spin();
     bool run_sensorless_control_loop();
     bool run_closed_loop_control_loop();
+    bool run_homing();
+    void homing_edge_cb();
     bool run_idle_loop();
 
     void run_state_machine_loop();
@@ -191,13 +224,19 @@ public:
     Controller& controller_;
     Motor& motor_;
     TrapezoidalTrajectory& trap_;
+    SCurveTrajectory s_curve_;
 
+    static const size_t stack_size_ = 4*512; // [words]
+    uint32_t thread_stack_[stack_size_];      // statically allocated with the axis object
+    osStaticThreadDef_t thread_control_block_;
     osThreadId thread_id_;
     volatile bool thread_id_valid_ = false;
+    uint32_t signal_timestamp_ = 0; // [TIM13 counts] when the current measurement was signaled
 
     // variables exposed on protocol
     Error_t error_ = ERROR_NONE;
     bool step_dir_active_ = false; // auto enabled after calibration, based on config.enable_step_dir
+    bool step_counter_active_ = false; // the steps are counted by the hardware timer
 
     // updated from config in constructor, and on protocol hook
     GPIO_TypeDef* step_port_;
@@ -205,12 +244,30 @@ public:
     GPIO_TypeDef* dir_port_;
     uint16_t dir_pin_;
 
+    // steps received since the last control loop iteration, written by the
+    // step interrupt (or the direction interrupt with the hardware counter)
+    int32_t step_counter_steps_ = 0;
+    uint16_t step_counter_last_ = 0;
+    bool step_counter_dir_ = true;
+    // step rate estimator, tracking the step position [counts]
+    Observer step_observer_;
+    float step_pos_err_ = 0.0f; // [counts] step position - estimated step position
+
     State_t requested_state_ = AXIS_STATE_STARTUP_SEQUENCE;
     State_t task_chain_[10] = { AXIS_STATE_UNDEFINED };
     State_t& current_state_ = task_chain_[0];
     uint32_t loop_counter_ = 0;
+    uint32_t wakeup_latency_ = 0;     // [clocks] from the current measurement interrupt to the control loop
+    uint32_t max_wakeup_latency_ = 0; // [clocks]
     LockinState_t lockin_state_ = LOCKIN_STATE_INACTIVE;
 
+    // homing
+    HomingState_t homing_state_ = HOMING_STATE_INACTIVE;
+    bool is_homed_ = false;
+    volatile bool homing_capture_armed_ = false;
+    volatile bool homing_captured_ = false;
+    volatile int32_t homing_captured_count_ = 0; // [counts] linear count at the last endstop/index edge
+
     // watchdog
     uint32_t watchdog_reset_value_ = 0; //computed from config_.watchdog_timeout in update_watchdog_settings()
     uint32_t watchdog_current_value_= 0;
@@ -220,18 +277,29 @@ public:
         return make_protocol_member_list(
             make_protocol_property("error", &error_),
             make_protocol_ro_property("step_dir_active", &step_dir_active_),
+            make_protocol_ro_property("step_counter_active", &step_counter_active_),
             make_protocol_ro_property("current_state", &current_state_),
             make_protocol_property("requested_state", &requested_state_),
             make_protocol_ro_property("loop_counter", &loop_counter_),
+            make_protocol_ro_property("wakeup_latency", &wakeup_latency_),
+            make_protocol_property("max_wakeup_latency", &max_wakeup_latency_),
             make_protocol_ro_property("lockin_state", &lockin_state_),
+            make_protocol_ro_property("homing_state", &homing_state_),
+            make_protocol_ro_property("is_homed", &is_homed_),
             make_protocol_object("config",
                 make_protocol_property("startup_motor_calibration", &config_.startup_motor_calibration),
                 make_protocol_property("startup_encoder_index_search", &config_.startup_encoder_index_search),
                 make_protocol_property("startup_encoder_offset_calibration", &config_.startup_encoder_offset_calibration),
+                make_protocol_property("startup_homing", &config_.startup_homing),
                 make_protocol_property("startup_closed_loop_control", &config_.startup_closed_loop_control),
                 make_protocol_property("startup_sensorless_control", &config_.startup_sensorless_control),
                 make_protocol_property("enable_step_dir", &config_.enable_step_dir),
                 make_protocol_property("counts_per_step", &config_.counts_per_step),
+                make_protocol_property("step_dir_use_timer", &config_.step_dir_use_timer),
+                make_protocol_property("step_dir_interpolation", &config_.step_dir_interpolation),
+                make_protocol_property("step_dir_vel_feed_forward", &config_.step_dir_vel_feed_forward),
+                make_protocol_property("step_dir_bandwidth", &config_.step_dir_bandwidth,
+                    [](void* ctx) { static_cast<Axis*>(ctx)->update_step_dir_estimator(); }, this),
                 make_protocol_property("watchdog_timeout", &config_.watchdog_timeout,
                     [](void* ctx) { static_cast<Axis*>(ctx)->update_watchdog_settings(); }, this),
                 make_protocol_property("step_gpio_pin", &config_.step_gpio_pin,
@@ -248,6 +316,17 @@ public:
                     make_protocol_property("finish_on_vel", &config_.lockin.finish_on_vel),
                     make_protocol_property("finish_on_distance", &config_.lockin.finish_on_distance),
                     make_protocol_property("finish_on_enc_idx", &config_.lockin.finish_on_enc_idx)
+                ),
+                make_protocol_object("homing",
+                    make_protocol_property("endstop_gpio_pin", &config_.homing.endstop_gpio_pin),
+                    make_protocol_property("endstop_active_low", &config_.homing.endstop_active_low),
+                    make_protocol_property("vel", &config_.homing.vel),
+                    make_protocol_property("slow_vel", &config_.homing.slow_vel),
+                    make_protocol_property("current_lim", &config_.homing.current_lim),
+                    make_protocol_property("backoff_distance", &config_.homing.backoff_distance),
+                    make_protocol_property("max_distance", &config_.homing.max_distance),
+                    make_protocol_property("use_index", &config_.homing.use_index),
+                    make_protocol_property("home_position", &config_.homing.home_position)
                 )
             ),
             make_protocol_object("motor", motor_.make_protocol_definitions()),
@@ -0,0 +1,62 @@
+
+#include "odrive_main.h"
+
+// @brief Computes the filter coefficients.
+// Returns false if the configuration is invalid, in which case the filter passes the signal through.
+bool BiquadFilter::configure(const Config_t& config) {
+    b0_ = 1.0f; b1_ = 0.0f; b2_ = 0.0f;
+    a1_ = 0.0f; a2_ = 0.0f;
+    reset();
+
+    if (config.type == TYPE_NONE)
+        return true;
+    if (!(config.frequency > 0.0f && config.frequency < 0.45f * (float)current_meas_hz))
+        return false;
+
+    // Continuous time prototype: (b0 s^2 + b1 s + b2) / (a0 s^2 + a1 s + a2)
+    float w = 2.0f * M_PI * config.frequency;
+    float b[3], a[3];
+    switch (config.type) {
+        case TYPE_LOWPASS: {
+            if (!(config.q > 0.0f))
+                return false;
+            b[0] = 0.0f; b[1] = 0.0f;  b[2] = SQ(w);
+            a[0] = 1.0f; a[1] = w / config.q; a[2] = SQ(w);
+        } break;
+        case TYPE_NOTCH: {
+            if (!(config.q > 0.0f) || !(config.ratio >= 0.0f))
+                return false;
+            float zeta_p = 0.5f / config.q;
+            float zeta_z = config.ratio * zeta_p;
+            b[0] = 1.0f; b[1] = 2.0f * zeta_z * w; b[2] = SQ(w);
+            a[0] = 1.0f; a[1] = 2.0f * zeta_p * w; a[2] = SQ(w);
+        } break;
+        case TYPE_LEAD_LAG: {
+            if (!(config.ratio > 0.0f))
+                return false;
+            // Maximum phase shift at w
+            float sqrt_ratio = sqrtf(config.ratio);
+            b[0] = 0.0f; b[1] = sqrt_ratio / w; b[2] = 1.0f;
+            a[0] = 0.0f; a[1] = 1.0f / (sqrt_ratio * w); a[2] = 1.0f;
+        } break;
+        default:
+            return false;
+    }
+
+    // Bilinear transform s = K (z - 1) / (z + 1), prewarped at w
+    float K = w / tanf(0.5f * w * current_meas_period);
+    float K2 = SQ(K);
+    float bz0 = b[0]*K2 + b[1]*K + b[2];
+    float bz1 = 2.0f * (b[2] - b[0]*K2);
+    float bz2 = b[0]*K2 - b[1]*K + b[2];
+    float az0 = a[0]*K2 + a[1]*K + a[2];
+    float az1 = 2.0f * (a[2] - a[0]*K2);
+    float az2 = a[0]*K2 - a[1]*K + a[2];
+
+    b0_ = bz0 / az0;
+    b1_ = bz1 / az0;
+    b2_ = bz2 / az0;
+    a1_ = az1 / az0;
+    a2_ = az2 / az0;
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __BIQUAD_HPP
+#define __BIQUAD_HPP
+
+#ifndef __ODRIVE_MAIN_H
+#error "This file should not be included directly. Include odrive_main.h instead."
+#endif
+
+// Second order IIR filter in direct form II transposed, running at the
+// control loop rate. The coefficients are derived from continuous time
+// prototypes with the bilinear transform, prewarped at the filter frequency.
+class BiquadFilter {
+public:
+    enum Type_t {
+        TYPE_NONE = 0,
+        TYPE_LOWPASS = 1,  // 2nd order low-pass
+        TYPE_NOTCH = 2,    // notch with configurable width and depth
+        TYPE_LEAD_LAG = 3, // 1st order lead (ratio > 1) or lag (ratio < 1)
+    };
+
+    struct Config_t {
+        Type_t type = TYPE_NONE;
+        float frequency = 1000.0f; // [Hz] cutoff, notch or center frequency
+        float q = 0.707f;          // quality factor (low-pass, notch)
+        float ratio = 0.0f;        // notch: gain at the notch frequency, lead-lag: pole/zero frequency ratio
+    };
+
+    bool configure(const Config_t& config);
+    void reset() { s1_ = 0.0f; s2_ = 0.0f; }
+    float update(float x) {
+        float y = b0_ * x + s1_;
+        s1_ = b1_ * x - a1_ * y + s2_;
+        s2_ = b2_ * x - a2_ * y;
+        return y;
+    }
+
+private:
+    // Normalized coefficients (a0 = 1), pass-through by default
+    float b0_ = 1.0f, b1_ = 0.0f, b2_ = 0.0f;
+    float a1_ = 0.0f, a2_ = 0.0f;
+    float s1_ = 0.0f, s2_ = 0.0f;
+};
+
+#endif // __BIQUAD_HPP
@@ -19,6 +19,15 @@
 #endif
 #endif
 
+// Number of axes in this build. The board has two motor channels, a
+// single-axis build (CONFIG_AXIS_COUNT=1) only drives M0.
+#ifndef HW_AXIS_COUNT
+#define HW_AXIS_COUNT 2
+#endif
+#if HW_AXIS_COUNT < 1 || HW_AXIS_COUNT > 2
+#error "this board supports 1 or 2 axes"
+#endif
+
 
 typedef struct {
     uint16_t step_gpio_pin;
@@ -30,6 +39,9 @@ typedef struct {
     TIM_HandleTypeDef* timer;
     GPIO_TypeDef* index_port;
     uint16_t index_pin;
+    bool index_capture; // true if the index pin is connected to an input capture channel of the encoder timer
+    uint32_t index_capture_channel;
+    uint8_t index_capture_af;
     GPIO_TypeDef* hallA_port;
     uint16_t hallA_pin;
     GPIO_TypeDef* hallB_port;
@@ -59,7 +71,23 @@ typedef struct {
     GateDriverHardwareConfig_t gate_driver_config;
 } BoardHardwareConfig_t;
 
+// Routing of the current measurements.
+// Each motor timer triggers a conversion on ADC2 and ADC3 (phase B and C),
+// which samples the currents of one axis. The same conversion is also used to
+// load the next PWM timings of an axis whose timer is half a period away.
+// The conversions keep running for motor channels without an axis.
+typedef struct {
+    TIM_HandleTypeDef* timer;
+    bool injected;                   // conversion group triggered by the timer
+    size_t axis;                     // axis whose currents are sampled
+    size_t next_timings_axis;        // axis whose PWM timings are loaded on this conversion
+    bool next_timings_counting_down; // timer direction in which the timings are loaded
+} CurrentMeasTrigger_t;
+
+#define CURRENT_MEAS_TRIGGER_COUNT 2
+
 extern const BoardHardwareConfig_t hw_configs[2];
+extern const CurrentMeasTrigger_t current_meas_triggers[CURRENT_MEAS_TRIGGER_COUNT];
 extern const float thermistor_poly_coeffs[];
 extern const size_t thermistor_num_coeffs;
 
@@ -80,6 +108,9 @@ const BoardHardwareConfig_t hw_configs[2] = { {
         .timer = &htim3,
         .index_port = M0_ENC_Z_GPIO_Port,
         .index_pin = M0_ENC_Z_Pin,
+        .index_capture = true, // PC9: TIM3_CH4
+        .index_capture_channel = TIM_CHANNEL_4,
+        .index_capture_af = GPIO_AF2_TIM3,
         .hallA_port = M0_ENC_A_GPIO_Port,
         .hallA_pin = M0_ENC_A_Pin,
         .hallB_port = M0_ENC_B_GPIO_Port,
@@ -119,6 +150,9 @@ const BoardHardwareConfig_t hw_configs[2] = { {
         .timer = &htim4,
         .index_port = M1_ENC_Z_GPIO_Port,
         .index_pin = M1_ENC_Z_Pin,
+        .index_capture = false, // PC15 has no timer function
+        .index_capture_channel = 0,
+        .index_capture_af = 0,
         .hallA_port = M1_ENC_A_GPIO_Port,
         .hallA_pin = M1_ENC_A_Pin,
         .hallB_port = M1_ENC_B_GPIO_Port,
@@ -147,6 +181,22 @@ const BoardHardwareConfig_t hw_configs[2] = { {
         .nFAULT_pin = nFAULT_Pin,
     }
 } };
+
+const CurrentMeasTrigger_t current_meas_triggers[CURRENT_MEAS_TRIGGER_COUNT] = { {
+    // M0: Timer 1 triggers the injected conversion
+    .timer = &htim1,
+    .injected = true,
+    .axis = 0,
+    .next_timings_axis = 1,
+    .next_timings_counting_down = false,
+},{
+    // M1: Timer 8 triggers the regular conversion
+    .timer = &htim8,
+    .injected = false,
+    .axis = 1,
+    .next_timings_axis = 0,
+    .next_timings_counting_down = true,
+} };
 #endif
 
 
@@ -4,13 +4,17 @@
 
 Controller::Controller(Config_t& config) :
     config_(config)
-{}
+{
+    update_gain_schedule();
+}
 
 void Controller::reset() {
     pos_setpoint_ = 0.0f;
     vel_setpoint_ = 0.0f;
     vel_integrator_current_ = 0.0f;
     current_setpoint_ = 0.0f;
+    disturbance_observer_active_ = false;
+    load_current_estimate_ = 0.0f;
 }
 
 void Controller::set_error(Error_t error) {
@@ -50,13 +54,117 @@ void Controller::set_current_setpoint(float current_setpoint) {
 }
 
 void Controller::move_to_pos(float goal_point) {
-    axis_->trap_.planTrapezoidal(goal_point, pos_setpoint_, vel_setpoint_,
-                                 axis_->trap_.config_.vel_limit,
-                                 axis_->trap_.config_.accel_limit,
-                                 axis_->trap_.config_.decel_limit);
-    traj_start_loop_count_ = axis_->loop_counter_;
+    // Take the start state together with the tick it belongs to
+    uint32_t prim = cpu_enter_critical();
+    uint32_t start_loop_count = axis_->loop_counter_;
+    float pos = pos_setpoint_;
+    float vel = load_vel_setpoint();
+    // Continue from the acceleration of a trajectory that is still running
+    float accel = (config_.control_mode == CTRL_MODE_TRAJECTORY_CONTROL) ? traj_accel_ : 0.0f;
+    cpu_exit_critical(prim);
+
+    // Plan into copies while the axis thread keeps evaluating the active
+    // trajectory. Planning is too slow to hold off the control loop.
+    TrapezoidalTrajectory trap(axis_->trap_);
+    SCurveTrajectory s_curve;
+    bool use_s_curve = false;
+    if (axis_->trap_.config_.jerk_limit > 0.0f) {
+        use_s_curve = s_curve.planSCurve(goal_point, pos, vel, accel,
+                                         axis_->trap_.config_.vel_limit,
+                                         axis_->trap_.config_.accel_limit,
+                                         axis_->trap_.config_.decel_limit,
+                                         axis_->trap_.config_.jerk_limit);
+    }
+    if (!use_s_curve) {
+        trap.planTrapezoidal(goal_point, pos, vel,
+                             axis_->trap_.config_.vel_limit,
+                             axis_->trap_.config_.accel_limit,
+                             axis_->trap_.config_.decel_limit);
+    }
+
+    // Swap in the new plan. It starts at the tick of its start state, so
+    // the setpoint stays continuous if the control loop ran in between.
+    prim = cpu_enter_critical();
+    if (use_s_curve)
+        axis_->s_curve_ = s_curve;
+    else
+        axis_->trap_.take_plan(trap);
+    traj_s_curve_ = use_s_curve;
+    traj_start_loop_count_ = start_loop_count;
     config_.control_mode = CTRL_MODE_TRAJECTORY_CONTROL;
     goal_point_ = goal_point;
+    cpu_exit_critical(prim);
+}
+
+// @brief Moves all axes to their goal points such that they start and finish
+// at the same time. The axis that needs the longest determines the
+// accel/coast/decel durations, which are then shared by all axes.
+// Coordinated moves always use trapezoidal profiles.
+bool Controller::move_coordinated(const float goal_points[AXIS_COUNT]) {
+    // Take the start states of all axes at the same instant
+    uint32_t start_loop_counts[AXIS_COUNT];
+    float start_pos[AXIS_COUNT], start_vel[AXIS_COUNT];
+    uint32_t prim = cpu_enter_critical();
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        Controller& controller = axes[i]->controller_;
+        start_loop_counts[i] = axes[i]->loop_counter_;
+        start_pos[i] = controller.pos_setpoint_;
+        start_vel[i] = controller.load_vel_setpoint();
+    }
+    cpu_exit_critical(prim);
+
+    // As in move_to_pos, plan into copies while the axes keep running.
+    // TrapezoidalTrajectory holds a config reference, so the copies are
+    // constructed in place.
+    std::aligned_storage<sizeof(TrapezoidalTrajectory), alignof(TrapezoidalTrajectory)>::type plan_storage[AXIS_COUNT];
+    TrapezoidalTrajectory* plans[AXIS_COUNT];
+    for (size_t i = 0; i < AXIS_COUNT; ++i)
+        plans[i] = new (&plan_storage[i]) TrapezoidalTrajectory(axes[i]->trap_);
+
+    // Plan each axis on its own to find the limiting one
+    float Ta = 0.0f, Tv = 0.0f, Td = 0.0f, Tf = -1.0f;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        TrapezoidalTrajectory& trap = *plans[i];
+        trap.planTrapezoidal(goal_points[i], start_pos[i], start_vel[i],
+                             trap.config_.vel_limit, trap.config_.accel_limit, trap.config_.decel_limit);
+        if (trap.Tf_ > Tf) {
+            Ta = trap.Ta_;
+            Tv = trap.Tv_;
+            Td = trap.Td_;
+            Tf = trap.Tf_;
+        }
+    }
+
+    // Give all axes the same timing. If that makes any axis exceed its
+    // limits, stretch the timing (for a move from standstill, the
+    // velocity scales with 1/k and the acceleration with 1/k^2).
+    float k = 1.0f;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        TrapezoidalTrajectory& trap = *plans[i];
+        trap.planTimed(goal_points[i], start_pos[i], start_vel[i], Ta, Tv, Td);
+        k = std::max(k, fabsf(trap.Vr_) / trap.config_.vel_limit);
+        k = std::max(k, sqrtf(fabsf(trap.Ar_) / trap.config_.accel_limit));
+        k = std::max(k, sqrtf(fabsf(trap.Dr_) / trap.config_.decel_limit));
+    }
+    if (!std::isfinite(k))
+        return false;
+    if (k > 1.0f) {
+        for (size_t i = 0; i < AXIS_COUNT; ++i)
+            plans[i]->planTimed(goal_points[i], start_pos[i], start_vel[i], k * Ta, k * Tv, k * Td);
+    }
+
+    // Swap in all plans at once, so they start on the same control loop tick
+    prim = cpu_enter_critical();
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        Controller& controller = axes[i]->controller_;
+        axes[i]->trap_.take_plan(*plans[i]);
+        controller.traj_start_loop_count_ = start_loop_counts[i];
+        controller.traj_s_curve_ = false;
+        controller.goal_point_ = goal_points[i];
+        controller.config_.control_mode = CTRL_MODE_TRAJECTORY_CONTROL;
+    }
+    cpu_exit_critical(prim);
+    return true;
 }
 
 void Controller::move_incremental(float displacement, bool from_goal_point = true){
@@ -67,9 +175,268 @@ void Controller::move_incremental(float displacement, bool from_goal_point = tru
     }
 }
 
+// @brief Returns the encoder that provides the position feedback.
+// This is the axis' own encoder unless a load encoder is configured.
+// Returns nullptr if the configuration is invalid.
+Encoder* Controller::load_encoder() {
+    if (config_.load_encoder_axis < 0)
+        return &axis_->encoder_;
+    if (config_.load_encoder_axis >= (int32_t)AXIS_COUNT)
+        return nullptr;
+    return &axes[config_.load_encoder_axis]->encoder_;
+}
+
+// @brief Returns the velocity setpoint in the units of the position setpoint.
+// vel_setpoint_ is in motor counts/s, so with a load encoder it must be
+// divided by the gear ratio before it's combined with pos_setpoint_.
+float Controller::load_vel_setpoint() {
+    Encoder* pos_encoder = load_encoder();
+    if (pos_encoder && pos_encoder != &axis_->encoder_ && config_.load_gear_ratio != 0.0f)
+        return vel_setpoint_ / config_.load_gear_ratio;
+    return vel_setpoint_;
+}
+
+// @brief Appends a point to the PVT buffer and switches to PVT control.
+// Returns false if the buffer is full.
+bool Controller::push_pvt_point(float dt, float pos, float vel) {
+    if (!(dt > 0.0f))
+        return false;
+    uint32_t write_idx = pvt_write_idx_;
+    uint32_t next_idx = (write_idx + 1) % PVT_BUFFER_SIZE;
+    bool start = config_.control_mode != CTRL_MODE_PVT_CONTROL;
+    if (!start && next_idx == pvt_read_idx_)
+        return false; // full
+
+    if (start) {
+        // Start streaming from the current setpoint. Points left over from
+        // an earlier stream are discarded before the new point is published,
+        // so update() never interpolates towards them.
+        pvt_clear_idx_ = write_idx;
+        pvt_clear_requested_ = true;
+        pvt_pos0_ = pos_setpoint_;
+        pvt_vel0_ = load_vel_setpoint();
+        pvt_t_ = 0.0f;
+    }
+
+    pvt_buffer_[write_idx] = {dt, pos, vel};
+    pvt_write_idx_ = next_idx; // publish the point only after it's written
+    config_.control_mode = CTRL_MODE_PVT_CONTROL;
+    return true;
+}
+
+// @brief Appends up to 4 points to the PVT buffer in one call.
+// Returns the number of points accepted.
+uint32_t Controller::append_pvt_points(uint32_t count,
+                                       float dt0, float pos0, float vel0,
+                                       float dt1, float pos1, float vel1,
+                                       float dt2, float pos2, float vel2,
+                                       float dt3, float pos3, float vel3) {
+    const PVTPoint_t points[] = {
+        {dt0, pos0, vel0}, {dt1, pos1, vel1}, {dt2, pos2, vel2}, {dt3, pos3, vel3}
+    };
+    uint32_t n = 0;
+    while (n < count && n < sizeof(points) / sizeof(points[0])) {
+        if (!push_pvt_point(points[n].dt, points[n].pos, points[n].vel))
+            break;
+        ++n;
+    }
+    return n;
+}
+
+// @brief Discards all points in the PVT buffer. The read index belongs to
+// the control loop, so this only posts a request that update() carries out.
+void Controller::clear_pvt_buffer() {
+    pvt_clear_idx_ = pvt_write_idx_;
+    pvt_clear_requested_ = true;
+}
+
+// @brief Interpolates the PVT buffer at the current time and updates the setpoints.
+void Controller::update_pvt() {
+    // Move on to the next segment(s) once the current one is done
+    pvt_t_ += current_meas_period;
+    uint32_t read_idx = pvt_read_idx_;
+    while (read_idx != pvt_write_idx_ && pvt_t_ >= pvt_buffer_[read_idx].dt) {
+        pvt_t_ -= pvt_buffer_[read_idx].dt;
+        pvt_pos0_ = pvt_buffer_[read_idx].pos;
+        pvt_vel0_ = pvt_buffer_[read_idx].vel;
+        read_idx = (read_idx + 1) % PVT_BUFFER_SIZE;
+    }
+    pvt_read_idx_ = read_idx;
+    pvt_buffer_fill_ = (pvt_write_idx_ + PVT_BUFFER_SIZE - read_idx) % PVT_BUFFER_SIZE;
+
+    if (read_idx == pvt_write_idx_) {
+        // Buffer ran dry: hold the last point. This is an underrun unless
+        // the stream ended at standstill.
+        if (pvt_vel0_ != 0.0f && !pvt_underrun_)
+            pvt_underrun_count_++;
+        pvt_underrun_ = true;
+        pvt_vel0_ = 0.0f;
+        pvt_t_ = 0.0f;
+        pos_setpoint_ = pvt_pos0_;
+        vel_setpoint_ = 0.0f;
+        current_setpoint_ = 0.0f;
+        return;
+    }
+    pvt_underrun_ = false;
+
+    // Cubic Hermite interpolation, relative to the segment start
+    const PVTPoint_t& p1 = pvt_buffer_[read_idx];
+    float h = p1.dt;
+    float s = pvt_t_ / h;
+    float dp = p1.pos - pvt_pos0_;
+    float hv0 = h * pvt_vel0_;
+    float hv1 = h * p1.vel;
+    float s2 = s * s;
+    float s3 = s2 * s;
+    float pos = (s3 - 2.0f*s2 + s) * hv0 + (-2.0f*s3 + 3.0f*s2) * dp + (s3 - s2) * hv1;
+    float vel = (3.0f*s2 - 4.0f*s + 1.0f) * hv0 + (-6.0f*s2 + 6.0f*s) * dp + (3.0f*s2 - 2.0f*s) * hv1;
+    float accel = (6.0f*s - 4.0f) * hv0 + (-12.0f*s + 6.0f) * dp + (6.0f*s - 2.0f) * hv1;
+
+    pos_setpoint_ = pvt_pos0_ + pos;
+    vel_setpoint_ = vel / h;
+    current_setpoint_ = accel / (h * h) * axis_->trap_.config_.A_per_css;
+}
+
+void Controller::set_cam_point(uint32_t index, float value) {
+    if (index < CAM_TABLE_SIZE)
+        config_.cam_table[index] = value;
+}
+
+float Controller::get_cam_point(uint32_t index) {
+    return (index < CAM_TABLE_SIZE) ? config_.cam_table[index] : 0.0f;
+}
+
+// @brief Precomputes the reciprocals of the breakpoint spacings, so that
+// the table lookup in the control loop needs no divisions.
+void Controller::update_gain_schedule() {
+    gain_schedule_inv_vel_step_ = (config_.gain_schedule_vel_step > 0.0f) ? 1.0f / config_.gain_schedule_vel_step : 0.0f;
+    gain_schedule_inv_param_step_ = (config_.gain_schedule_param_step > 0.0f) ? 1.0f / config_.gain_schedule_param_step : 0.0f;
+}
+
+void Controller::set_gain_schedule_point(uint32_t param_index, uint32_t vel_index,
+        float pos_gain_scale, float vel_gain_scale, float vel_integrator_gain_scale) {
+    if (param_index < GAIN_SCHEDULE_PARAM_POINTS && vel_index < GAIN_SCHEDULE_VEL_POINTS) {
+        GainScale_t& point = config_.gain_schedule[param_index][vel_index];
+        point.pos_gain = pos_gain_scale;
+        point.vel_gain = vel_gain_scale;
+        point.vel_integrator_gain = vel_integrator_gain_scale;
+    }
+}
+
+// @param gain: 0: pos_gain, 1: vel_gain, 2: vel_integrator_gain
+float Controller::get_gain_schedule_point(uint32_t param_index, uint32_t vel_index, uint32_t gain) {
+    if (param_index >= GAIN_SCHEDULE_PARAM_POINTS || vel_index >= GAIN_SCHEDULE_VEL_POINTS)
+        return 0.0f;
+    const GainScale_t& point = config_.gain_schedule[param_index][vel_index];
+    switch (gain) {
+        case 0: return point.pos_gain;
+        case 1: return point.vel_gain;
+        case 2: return point.vel_integrator_gain;
+        default: return 0.0f;
+    }
+}
+
+// @brief Bilinear interpolation of the gain scale factors.
+// Beyond the last breakpoint the last value is held.
+Controller::GainScale_t Controller::eval_gain_schedule(float vel_estimate) {
+    // Maps a non-negative, scaled input to a table index and interpolation weight
+    auto locate = [](float x, size_t n, size_t* idx, float* frac) {
+        if (x >= (float)(n - 1)) {
+            *idx = n - 2;
+            *frac = 1.0f;
+        } else {
+            *idx = (size_t)x;
+            *frac = x - (float)*idx;
+        }
+    };
+
+    size_t v_idx;
+    float v_frac;
+    locate(fabsf(vel_estimate) * gain_schedule_inv_vel_step_, GAIN_SCHEDULE_VEL_POINTS, &v_idx, &v_frac);
+
+    float param;
+    switch (config_.gain_schedule_param_source) {
+        case GAIN_SCHEDULE_PARAM_LOAD_CURRENT: param = fabsf(load_current_estimate_); break;
+        case GAIN_SCHEDULE_PARAM_USER: param = std::max(gain_schedule_param_, 0.0f); break;
+        default: param = 0.0f; break;
+    }
+    size_t p_idx;
+    float p_frac;
+    locate(param * gain_schedule_inv_param_step_, GAIN_SCHEDULE_PARAM_POINTS, &p_idx, &p_frac);
+
+    const GainScale_t& s00 = config_.gain_schedule[p_idx][v_idx];
+    const GainScale_t& s01 = config_.gain_schedule[p_idx][v_idx + 1];
+    const GainScale_t& s10 = config_.gain_schedule[p_idx + 1][v_idx];
+    const GainScale_t& s11 = config_.gain_schedule[p_idx + 1][v_idx + 1];
+    float w00 = (1.0f - p_frac) * (1.0f - v_frac);
+    float w01 = (1.0f - p_frac) * v_frac;
+    float w10 = p_frac * (1.0f - v_frac);
+    float w11 = p_frac * v_frac;
+
+    GainScale_t scale;
+    scale.pos_gain = w00 * s00.pos_gain + w01 * s01.pos_gain + w10 * s10.pos_gain + w11 * s11.pos_gain;
+    scale.vel_gain = w00 * s00.vel_gain + w01 * s01.vel_gain + w10 * s10.vel_gain + w11 * s11.vel_gain;
+    scale.vel_integrator_gain = w00 * s00.vel_integrator_gain + w01 * s01.vel_integrator_gain
+                              + w10 * s10.vel_integrator_gain + w11 * s11.vel_integrator_gain;
+    return scale;
+}
+
+// @brief Derives the setpoints from the position of another axis,
+// either through a fixed ratio (gearing) or through the cam table (camming).
+// Returns false if the configuration is invalid.
+bool Controller::update_follow() {
+    if (config_.follow_axis < 0 || config_.follow_axis >= (int32_t)AXIS_COUNT)
+        return false;
+    Axis* master = axes[config_.follow_axis];
+    if (master == axis_)
+        return false;
+
+    float master_pos, master_vel;
+    if (config_.follow_source == FOLLOW_SOURCE_POS_SETPOINT) {
+        master_pos = master->controller_.pos_setpoint_;
+        master_vel = master->controller_.load_vel_setpoint();
+    } else {
+        master_pos = master->encoder_.pos_estimate_;
+        master_vel = master->encoder_.vel_estimate_;
+    }
+
+    float pos = master_pos;
+    float slope = 1.0f; // [counts / master counts]
+    if (config_.cam_enable) {
+        size_t n = config_.cam_points;
+        if (n < 2 || n > CAM_TABLE_SIZE || !(config_.cam_period > 0.0f))
+            return false;
+        // Linear interpolation between equally spaced points
+        float x = fmodf_pos(master_pos, config_.cam_period) * ((float)n / config_.cam_period);
+        size_t i = std::min((size_t)x, n - 1);
+        size_t i_next = (i + 1) % n;
+        float frac = x - (float)i;
+        float rise = config_.cam_table[i_next] - config_.cam_table[i];
+        pos = config_.cam_table[i] + frac * rise;
+        slope = rise * ((float)n / config_.cam_period);
+    }
+
+    pos *= config_.follow_ratio;
+    if (!following_) {
+        // Keep the current setpoint where we start following
+        follow_offset_ = pos_setpoint_ - pos;
+        following_ = true;
+    }
+    pos_setpoint_ = follow_offset_ + pos;
+    vel_setpoint_ = config_.follow_ratio * slope * master_vel;
+    current_setpoint_ = 0.0f;
+    return true;
+}
+
 void Controller::start_anticogging_calibration() {
-    // Ensure the cogging map was correctly allocated earlier and that the motor is capable of calibrating
-    if (anticogging_.cogging_map != NULL && axis_->error_ == Axis::ERROR_NONE) {
+    // Ensure the cogging map covers the encoder and that the motor is capable of calibrating
+    // The calibration commands motor encoder positions, so it can't run on a load encoder
+    if (anticogging_.cogging_map == NULL || axis_->encoder_.config_.cpr > ANTICOGGING_MAX_CPR) {
+        set_error(ERROR_ANTICOGGING_MAP_UNAVAILABLE);
+        return;
+    }
+    if (axis_->error_ == Axis::ERROR_NONE &&
+        load_encoder() == &axis_->encoder_) {
         anticogging_.calib_anticogging = true;
     }
 }
@@ -82,7 +449,8 @@ void Controller::start_anticogging_calibration() {
  * This holding current is added as a feedforward term in the control loop.
  */
 bool Controller::anticogging_calibration(float pos_estimate, float vel_estimate) {
-    if (anticogging_.calib_anticogging && anticogging_.cogging_map != NULL) {
+    if (anticogging_.calib_anticogging && anticogging_.cogging_map != NULL &&
+        axis_->encoder_.config_.cpr <= ANTICOGGING_MAX_CPR) {
         float pos_err = anticogging_.index - pos_estimate;
         if (fabsf(pos_err) <= anticogging_.calib_pos_threshold &&
             fabsf(vel_estimate) < anticogging_.calib_vel_threshold) {
@@ -102,29 +470,239 @@ bool Controller::anticogging_calibration(float pos_estimate, float vel_estimate)
     return false;
 }
 
-bool Controller::update(float pos_estimate, float vel_estimate, float* current_setpoint_output) {
+// Solves A x = b for a symmetric 3x3 matrix with Cramer's rule.
+// Returns false if A is (close to) singular.
+static bool solve_3x3(const float A[3][3], const float b[3], float x[3]) {
+    auto det3 = [](float a00, float a01, float a02,
+                   float a10, float a11, float a12,
+                   float a20, float a21, float a22) {
+        return a00 * (a11 * a22 - a12 * a21)
+             - a01 * (a10 * a22 - a12 * a20)
+             + a02 * (a10 * a21 - a11 * a20);
+    };
+    float det = det3(A[0][0], A[0][1], A[0][2],
+                     A[1][0], A[1][1], A[1][2],
+                     A[2][0], A[2][1], A[2][2]);
+    float scale = A[0][0] * A[1][1] * A[2][2];
+    if (!(fabsf(det) > 1e-6f * scale))
+        return false;
+    x[0] = det3(b[0], A[0][1], A[0][2],
+                b[1], A[1][1], A[1][2],
+                b[2], A[2][1], A[2][2]) / det;
+    x[1] = det3(A[0][0], b[0], A[0][2],
+                A[1][0], b[1], A[1][2],
+                A[2][0], b[2], A[2][2]) / det;
+    x[2] = det3(A[0][0], A[0][1], b[0],
+                A[1][0], A[1][1], b[1],
+                A[2][0], A[2][1], b[2]) / det;
+    return true;
+}
+
+/*
+ * Identifies the mechanical load and tunes the controller gains.
+ *
+ * A relay with hysteresis on the velocity drives the axis back and forth
+ * between +-autotune.travel around the start position, at a different speed
+ * on each stroke. Over blocks of a few milliseconds, the model
+ *   J * dv/dt = Iq - B * v - C * sign(v)
+ * is integrated and J (inertia), B (viscous friction) and C (Coulomb friction)
+ * are fitted by least squares. The velocity is estimated from the raw count,
+ * and Iq and sign(v) are passed through the same observer, so that the lag
+ * of the estimate does not bias the fit.
+ *
+ * The velocity loop gains are then chosen to place the closed loop poles at
+ * the target bandwidth and damping:
+ *   vel_gain = 2 * damping * w * J, vel_integrator_gain = w^2 * J
+ * and pos_gain is set to a quarter of the velocity loop bandwidth.
+ */
+bool Controller::run_autotune() {
+    const AutotuneConfig_t& cfg = config_.autotune;
+    Encoder& encoder = axis_->encoder_;
+    Motor& motor = axis_->motor_;
+
+    if (!(cfg.current > 0.0f && cfg.vel > 0.0f && cfg.travel > 0.0f &&
+          cfg.duration > 0.0f && cfg.bandwidth > 0.0f && cfg.damping > 0.0f)) {
+        set_error(ERROR_AUTOTUNE_FAILED);
+        return false;
+    }
+
+    // Velocity estimators for the regression, see above
+    Observer vel_obs, current_obs, sign_obs;
+    if (!vel_obs.set_bandwidth(Observer::TYPE_PLL, encoder.config_.bandwidth)) {
+        set_error(ERROR_AUTOTUNE_FAILED);
+        return false;
+    }
+    current_obs = vel_obs;
+    sign_obs = vel_obs;
+    auto track = [](Observer& obs, float& pos, float measured) {
+        pos += obs.predict(0.0f);
+        pos += obs.correct(measured - pos);
+        return obs.vel_estimate_;
+    };
+    float vel_obs_pos = 0.0f, current_obs_pos = 0.0f, sign_obs_pos = 0.0f;
+    float current_integral = 0.0f, sign_integral = 0.0f;
+
+    const int block_len = std::max(current_meas_hz / 200, 1);
+    const float block_time = block_len * current_meas_period;
+    float A[3][3] = {{0.0f}};
+    float b[3] = {0.0f};
+    float block_start_vel = 0.0f, block_pos = 0.0f;
+    float block_current = 0.0f, block_sign = 0.0f;
+    int block_idx = 0;
+
+    const float Ilim = std::min(cfg.current, motor.effective_current_lim());
+    const float hysteresis = 0.05f * cfg.vel;
+    const int num_steps = (int)(cfg.duration * (float)current_meas_hz);
+    const int32_t start_count = encoder.shadow_count_;
+    const float start_pos = encoder.pos_estimate_;
+    float dir = 1.0f;
+    float relay = 1.0f;
+    uint32_t stroke = 0;
+    float Iq = 0.0f;
+    int i = 0;
+
+    axis_->run_control_loop([&](){
+        // Excitation
+        float pos = encoder.pos_estimate_ - start_pos;
+        if (fabsf(pos) > 2.0f * cfg.travel) {
+            set_error(ERROR_AUTOTUNE_TRAVEL_EXCEEDED);
+            return false;
+        }
+        if (pos > cfg.travel && dir > 0.0f) {
+            dir = -1.0f;
+            ++stroke;
+        } else if (pos < -cfg.travel && dir < 0.0f) {
+            dir = 1.0f;
+            ++stroke;
+        }
+        float vel_target = dir * cfg.vel * (1.0f - 0.25f * (float)(stroke % 4));
+        if (encoder.vel_estimate_ < vel_target - hysteresis)
+            relay = 1.0f;
+        else if (encoder.vel_estimate_ > vel_target + hysteresis)
+            relay = -1.0f;
+
+        // Regression on the current applied during the last period
+        float vel = track(vel_obs, vel_obs_pos, (float)(encoder.shadow_count_ - start_count));
+        current_integral += current_meas_period * Iq;
+        sign_integral += current_meas_period * ((vel > 0.0f) ? 1.0f : ((vel < 0.0f) ? -1.0f : 0.0f));
+        block_pos += current_meas_period * vel;
+        block_current += current_meas_period * track(current_obs, current_obs_pos, current_integral);
+        block_sign += current_meas_period * track(sign_obs, sign_obs_pos, sign_integral);
+        if (++block_idx == block_len) {
+            // Regressors normalized to O(1) for float precision
+            float phi[3] = {
+                (vel - block_start_vel) / cfg.vel,
+                block_pos / (cfg.vel * block_time),
+                block_sign / block_time
+            };
+            for (size_t row = 0; row < 3; ++row) {
+                b[row] += phi[row] * block_current;
+                for (size_t col = 0; col < 3; ++col)
+                    A[row][col] += phi[row] * phi[col];
+            }
+            block_start_vel = vel;
+            block_pos = 0.0f;
+            block_current = 0.0f;
+            block_sign = 0.0f;
+            block_idx = 0;
+        }
+
+        Iq = relay * Ilim;
+        float phase_vel = 2*M_PI * encoder.vel_estimate_ / (float)encoder.config_.cpr * motor.config_.pole_pairs;
+        if (!motor.update(Iq, encoder.phase_, phase_vel))
+            return false; // set_error should update axis.error_
+        return ++i < num_steps;
+    });
+    if (axis_->error_ != Axis::ERROR_NONE || i < num_steps)
+        return false;
+
+    float theta[3];
+    if (!solve_3x3(A, b, theta)) {
+        set_error(ERROR_AUTOTUNE_FAILED);
+        return false;
+    }
+    float inertia = theta[0] / cfg.vel; // [A / (counts/s^2)]
+    if (!(inertia > 0.0f)) {
+        set_error(ERROR_AUTOTUNE_FAILED);
+        return false;
+    }
+    autotune_accel_per_amp_ = 1.0f / inertia;
+    autotune_viscous_friction_ = theta[1] / (cfg.vel * block_time);
+    autotune_coulomb_friction_ = theta[2] / block_time;
+
+    float w = 2.0f * M_PI * cfg.bandwidth;
+    config_.vel_gain = 2.0f * cfg.damping * w * inertia;
+    config_.vel_integrator_gain = w * w * inertia;
+    config_.pos_gain = 0.25f * w;
+    config_.disturbance_observer_accel_per_amp = autotune_accel_per_amp_;
+    return true;
+}
+
+RAMFUNC bool Controller::update(float pos_estimate, float vel_estimate, float* current_setpoint_output) {
     // Only runs if anticogging_.calib_anticogging is true; non-blocking
     anticogging_calibration(pos_estimate, vel_estimate);
     float anticogging_pos = pos_estimate;
 
+    // Step/dir input
+    if (axis_->step_dir_active_)
+        axis_->update_step_dir();
+
+    // Discard the PVT points that were buffered when clear_pvt_buffer() was called
+    if (pvt_clear_requested_) {
+        pvt_clear_requested_ = false;
+        pvt_read_idx_ = pvt_clear_idx_;
+    }
+
+    // Position feedback comes from the load encoder if one is selected.
+    // Position setpoints are then in load counts, while velocity and
+    // current are still controlled on the motor side.
+    Encoder* pos_encoder = load_encoder();
+    if (!pos_encoder || pos_encoder->error_ != Encoder::ERROR_NONE) {
+        set_error(ERROR_INVALID_LOAD_ENCODER);
+        return false;
+    }
+    bool use_load_encoder = pos_encoder != &axis_->encoder_;
+    float gear_ratio = use_load_encoder ? config_.load_gear_ratio : 1.0f;
+    float pos_feedback = use_load_encoder ? pos_encoder->pos_estimate_ : pos_estimate;
+
     // Trajectory control
     if (config_.control_mode == CTRL_MODE_TRAJECTORY_CONTROL) {
         // Note: uint32_t loop count delta is OK across overflow
         // Beware of negative deltas, as they will not be well behaved due to uint!
-        float t = (axis_->loop_counter_ - traj_start_loop_count_) * current_meas_period;
-        if (t > axis_->trap_.Tf_) {
-            // Drop into position control mode when done to avoid problems on loop counter delta overflow
+        uint32_t tick = axis_->loop_counter_ - traj_start_loop_count_;
+        TrapezoidalTrajectory::Step_t traj_step = traj_s_curve_ ? axis_->s_curve_.eval(tick) : axis_->trap_.eval(tick);
+        traj_accel_ = traj_step.Ydd;
+        pos_setpoint_ = traj_step.Y;
+        vel_setpoint_ = traj_step.Yd * gear_ratio;
+        current_setpoint_ = traj_step.Ydd * gear_ratio * axis_->trap_.config_.A_per_css;
+        uint32_t end_tick = traj_s_curve_ ? axis_->s_curve_.end_tick_ : axis_->trap_.end_tick_;
+        if (tick >= end_tick) {
+            // Drop into position control mode when done to avoid problems on loop counter delta overflow.
+            // The final step has set pos_setpoint to the goal and the velocity and current to zero.
             config_.control_mode = CTRL_MODE_POSITION_CONTROL;
-            // pos_setpoint already set by trajectory
-            vel_setpoint_ = 0.0f;
-            current_setpoint_ = 0.0f;
-        } else {
-            TrapezoidalTrajectory::Step_t traj_step = axis_->trap_.eval(t);
-            pos_setpoint_ = traj_step.Y;
-            vel_setpoint_ = traj_step.Yd;
-            current_setpoint_ = traj_step.Ydd * axis_->trap_.config_.A_per_css;
         }
-        anticogging_pos = pos_setpoint_; // FF the position setpoint instead of the pos_estimate
+        if (!use_load_encoder)
+            anticogging_pos = pos_setpoint_; // FF the position setpoint instead of the pos_estimate
+    }
+
+    // Streamed PVT control
+    if (config_.control_mode == CTRL_MODE_PVT_CONTROL) {
+        update_pvt();
+        vel_setpoint_ *= gear_ratio;
+        current_setpoint_ *= gear_ratio;
+        if (!use_load_encoder)
+            anticogging_pos = pos_setpoint_; // FF the position setpoint instead of the pos_estimate
+    }
+
+    // Electronic gearing/camming
+    if (config_.control_mode == CTRL_MODE_FOLLOW) {
+        if (!update_follow()) {
+            set_error(ERROR_INVALID_FOLLOW_AXIS);
+            return false;
+        }
+        vel_setpoint_ *= gear_ratio;
+    } else {
+        following_ = false;
     }
 
     // Ramp rate limited velocity setpoint
@@ -140,24 +718,84 @@ bool Controller::update(float pos_estimate, float vel_estimate, float* current_s
         vel_setpoint_ += step;
     }
 
+    // Ramp rate limited current setpoint
+    if (config_.control_mode == CTRL_MODE_CURRENT_CONTROL && current_ramp_enable_) {
+        float max_step_size = current_meas_period * config_.current_ramp_rate;
+        float full_step = current_ramp_target_ - current_setpoint_;
+        float step;
+        if (fabsf(full_step) > max_step_size) {
+            step = std::copysignf(max_step_size, full_step);
+        } else {
+            step = full_step;
+        }
+        current_setpoint_ += step;
+    }
+
+    // Input shaping of the position, velocity and current setpoints
+    // Not applicable to circular setpoints, which wrap around.
+    float setpoints[InputShaper::NUM_CHANNELS] = {pos_setpoint_, vel_setpoint_, current_setpoint_};
+    bool shaping = config_.control_mode >= CTRL_MODE_POSITION_CONTROL && !config_.setpoints_in_cpr;
+    if (input_shaper_dirty_) {
+        // Reconfigure in the control loop, where the shaper is used
+        input_shaper_dirty_ = false;
+        if (!input_shaper_.configure(config_.input_shaper_type, config_.input_shaper_freq, config_.input_shaper_damping))
+            config_.input_shaper_type = InputShaper::TYPE_NONE;
+        input_shaper_active_ = false;
+    }
+    if (shaping) {
+        // Start from the current setpoints to avoid a transient
+        if (!input_shaper_active_)
+            input_shaper_.reset(setpoints);
+        input_shaper_.update(setpoints, setpoints);
+    }
+    input_shaper_active_ = shaping;
+    shaped_pos_setpoint_ = setpoints[0];
+
+    // Gain scheduling
+    float pos_gain = config_.pos_gain;
+    float vel_gain = config_.vel_gain;
+    float vel_integrator_gain = config_.vel_integrator_gain;
+    if (config_.gain_schedule_enable) {
+        GainScale_t scale = eval_gain_schedule(vel_estimate);
+        pos_gain *= scale.pos_gain;
+        vel_gain *= scale.vel_gain;
+        vel_integrator_gain *= scale.vel_integrator_gain;
+    }
+
     // Position control
     // TODO Decide if we want to use encoder or pll position here
-    float vel_des = vel_setpoint_;
+    float vel_des = setpoints[1];
     if (config_.control_mode >= CTRL_MODE_POSITION_CONTROL) {
         float pos_err;
         if (config_.setpoints_in_cpr) {
             // TODO this breaks the semantics that estimates come in on the arguments.
             // It's probably better to call a get_estimate that will arbitrate (enc vs sensorless) instead.
-            float cpr = (float)(axis_->encoder_.config_.cpr);
+            float cpr = (float)(pos_encoder->config_.cpr);
             // Keep pos setpoint from drifting
             pos_setpoint_ = fmodf_pos(pos_setpoint_, cpr);
             // Circular delta
-            pos_err = pos_setpoint_ - axis_->encoder_.pos_cpr_;
+            pos_err = pos_setpoint_ - pos_encoder->pos_cpr_;
             pos_err = wrap_pm(pos_err, 0.5f * cpr);
         } else {
-            pos_err = pos_setpoint_ - pos_estimate;
+            pos_err = shaped_pos_setpoint_ - pos_feedback;
         }
-        vel_des += config_.pos_gain * pos_err;
+        vel_des += pos_gain * gear_ratio * pos_err;
+    }
+
+    // Soft position limits
+    // Limit the velocity such that the axis can always stop inside the
+    // limits with the decel_limit of the trajectory planner.
+    // The limits refer to the homed position, so they don't apply while homing.
+    bool soft_limits = config_.soft_limits_enable && !config_.setpoints_in_cpr
+                       && axis_->homing_state_ == Axis::HOMING_STATE_INACTIVE
+                       && axis_->trap_.config_.decel_limit > 0.0f;
+    float soft_vel_max = 0.0f, soft_vel_min = 0.0f;
+    if (soft_limits) {
+        float two_decel = 2.0f * axis_->trap_.config_.decel_limit;
+        soft_vel_max = gear_ratio * sqrtf(two_decel * std::max(config_.soft_limit_max - pos_feedback, 0.0f));
+        soft_vel_min = -gear_ratio * sqrtf(two_decel * std::max(pos_feedback - config_.soft_limit_min, 0.0f));
+        if (vel_des > soft_vel_max) vel_des = soft_vel_max;
+        if (vel_des < soft_vel_min) vel_des = soft_vel_min;
     }
 
     // Velocity limiting
@@ -174,26 +812,84 @@ bool Controller::update(float pos_estimate, float vel_estimate, float* current_s
     }
 
     // Velocity control
-    float Iq = current_setpoint_;
+    float Iq = setpoints[2];
 
     // Anti-cogging is enabled after calibration
     // We get the current position and apply a current feed-forward
     // ensuring that we handle negative encoder positions properly (-1 == motor->encoder.encoder_cpr - 1)
-    if (anticogging_.use_anticogging) {
+    if (anticogging_.use_anticogging && anticogging_.cogging_map &&
+        axis_->encoder_.config_.cpr <= ANTICOGGING_MAX_CPR) {
         Iq += anticogging_.cogging_map[mod(static_cast<int>(anticogging_pos), axis_->encoder_.config_.cpr)];
     }
 
     float v_err = vel_des - vel_estimate;
     if (config_.control_mode >= CTRL_MODE_VELOCITY_CONTROL) {
-        Iq += config_.vel_gain * v_err;
+        Iq += vel_gain * v_err;
     }
 
     // Velocity integral action before limiting
     Iq += vel_integrator_current_;
 
+    // Velocity limiting in current control mode: clamp the commanded current
+    // to the range a velocity controller at +-vel_limit would command, so an
+    // unloaded axis is held at the limit instead of running away.
+    if (config_.control_mode == CTRL_MODE_CURRENT_CONTROL && config_.enable_current_mode_vel_limit) {
+        Iq = std::max(Iq, vel_gain * (-vel_lim - vel_estimate));
+        Iq = std::min(Iq, vel_gain * (vel_lim - vel_estimate));
+    }
+
+    // Without the velocity loop, brake with the velocity gain when the axis
+    // is too fast to stop inside the soft limits
+    if (soft_limits && config_.control_mode < CTRL_MODE_VELOCITY_CONTROL) {
+        if (vel_estimate > soft_vel_max)
+            Iq = std::min(Iq, vel_gain * (soft_vel_max - vel_estimate));
+        if (vel_estimate < soft_vel_min)
+            Iq = std::max(Iq, vel_gain * (soft_vel_min - vel_estimate));
+    }
+
+    // Disturbance observer
+    // Model: Iq = dv/dt / accel_per_amp + load_current. The load current is
+    // low-pass filtered with the observer bandwidth L. To avoid differentiating
+    // the velocity, the state is z = load_current + L * v / accel_per_amp:
+    // dz/dt = L * (Iq - z + L * v / accel_per_amp)
+    if (config_.disturbance_observer_enable && config_.disturbance_observer_accel_per_amp > 0.0f) {
+        // Keep the forward Euler update stable
+        float L = std::min(config_.disturbance_observer_bandwidth, 0.25f * (float)current_meas_hz);
+        float vel_current = L * vel_estimate / config_.disturbance_observer_accel_per_amp;
+        if (!disturbance_observer_active_) {
+            // Start with a zero estimate
+            disturbance_observer_state_ = vel_current;
+            last_Iq_ = 0.0f;
+            disturbance_observer_active_ = true;
+        }
+        disturbance_observer_state_ += current_meas_period * L * (last_Iq_ - disturbance_observer_state_ + vel_current);
+        load_current_estimate_ = disturbance_observer_state_ - vel_current;
+        if (config_.control_mode >= CTRL_MODE_VELOCITY_CONTROL)
+            Iq += config_.disturbance_observer_gain * load_current_estimate_;
+    } else {
+        disturbance_observer_active_ = false;
+        load_current_estimate_ = 0.0f;
+    }
+
+    // Torque command filters (notch/low-pass/lead-lag)
+    if (torque_filters_dirty_) {
+        // Reconfigure in the control loop, where the filters are used
+        torque_filters_dirty_ = false;
+        for (size_t i = 0; i < TORQUE_FILTER_COUNT; ++i) {
+            if (!torque_filters_[i].configure(config_.torque_filters[i]))
+                config_.torque_filters[i].type = BiquadFilter::TYPE_NONE;
+        }
+    }
+    for (size_t i = 0; i < TORQUE_FILTER_COUNT; ++i) {
+        if (config_.torque_filters[i].type != BiquadFilter::TYPE_NONE)
+            Iq = torque_filters_[i].update(Iq);
+    }
+
     // Current limiting
     bool limited = false;
     float Ilim = axis_->motor_.effective_current_lim();
+    if (current_lim_ > 0.0f)
+        Ilim = std::min(Ilim, current_lim_);
     if (Iq > Ilim) {
         limited = true;
         Iq = Ilim;
@@ -212,10 +908,11 @@ bool Controller::update(float pos_estimate, float vel_estimate, float* current_s
             // TODO make decayfactor configurable
             vel_integrator_current_ *= 0.99f;
         } else {
-            vel_integrator_current_ += (config_.vel_integrator_gain * current_meas_period) * v_err;
+            vel_integrator_current_ += (vel_integrator_gain * current_meas_period) * v_err;
         }
     }
 
+    last_Iq_ = Iq;
     if (current_setpoint_output) *current_setpoint_output = Iq;
     return true;
 }
@@ -10,6 +10,11 @@ public:
     enum Error_t {
         ERROR_NONE = 0,
         ERROR_OVERSPEED = 0x01,
+        ERROR_INVALID_LOAD_ENCODER = 0x02,
+        ERROR_INVALID_FOLLOW_AXIS = 0x04,
+        ERROR_AUTOTUNE_FAILED = 0x08,           //<! invalid autotune config or the load could not be identified
+        ERROR_AUTOTUNE_TRAVEL_EXCEEDED = 0x10,  //<! the axis moved further than 2 * autotune.travel
+        ERROR_ANTICOGGING_MAP_UNAVAILABLE = 0x20, //<! the encoder cpr is larger than ANTICOGGING_MAX_CPR
     };
 
     // Note: these should be sorted from lowest level of control to
@@ -19,7 +24,53 @@ public:
         CTRL_MODE_CURRENT_CONTROL = 1,
         CTRL_MODE_VELOCITY_CONTROL = 2,
         CTRL_MODE_POSITION_CONTROL = 3,
-        CTRL_MODE_TRAJECTORY_CONTROL = 4
+        CTRL_MODE_TRAJECTORY_CONTROL = 4,
+        CTRL_MODE_PVT_CONTROL = 5,
+        CTRL_MODE_FOLLOW = 6
+    };
+
+    enum FollowSource_t {
+        FOLLOW_SOURCE_POS_ESTIMATE = 0,
+        FOLLOW_SOURCE_POS_SETPOINT = 1
+    };
+    static constexpr size_t CAM_TABLE_SIZE = 32;
+    // The anticogging maps are statically allocated for this encoder cpr,
+    // which is the default. Anticogging is not available above it.
+    static constexpr int32_t ANTICOGGING_MAX_CPR = 8192;
+    static constexpr size_t TORQUE_FILTER_COUNT = 4;
+
+    // Gain scheduling: the gains are scaled by factors that are bilinearly
+    // interpolated from a table indexed by |vel_estimate| and optionally a
+    // second parameter.
+    enum GainScheduleParam_t {
+        GAIN_SCHEDULE_PARAM_NONE = 0,         // only the first row of the table is used
+        GAIN_SCHEDULE_PARAM_LOAD_CURRENT = 1, // |load_current_estimate|, requires the disturbance observer
+        GAIN_SCHEDULE_PARAM_USER = 2,         // gain_schedule_param set by the user
+    };
+    static constexpr size_t GAIN_SCHEDULE_VEL_POINTS = 8;
+    static constexpr size_t GAIN_SCHEDULE_PARAM_POINTS = 4;
+    struct GainScale_t {
+        float pos_gain = 1.0f;
+        float vel_gain = 1.0f;
+        float vel_integrator_gain = 1.0f;
+    };
+
+    // Streamed position-velocity-time point. The segment between the
+    // previous point and this one is interpolated with a cubic Hermite spline.
+    struct PVTPoint_t {
+        float dt;  // [s] time since the previous point
+        float pos; // [count]
+        float vel; // [count/s]
+    };
+    static constexpr size_t PVT_BUFFER_SIZE = 32;
+
+    struct AutotuneConfig_t {
+        float current = 5.0f;     // [A] relay amplitude, limited to the motor current limit
+        float vel = 5000.0f;      // [counts/s] maximum speed of the excitation
+        float travel = 4000.0f;   // [counts] the axis reverses beyond +-travel from the start position
+        float duration = 3.0f;    // [s]
+        float bandwidth = 20.0f;  // [Hz] target velocity loop bandwidth
+        float damping = 1.0f;     // target velocity loop damping ratio
     };
 
     struct Config_t {
@@ -31,7 +82,40 @@ public:
         float vel_limit = 20000.0f;        // [counts/s]
         float vel_limit_tolerance = 1.2f;  // ratio to vel_lim. 0.0f to disable
         float vel_ramp_rate = 10000.0f;  // [(counts/s) / s]
+        float current_ramp_rate = 10.0f; // [A/s]
+        bool enable_current_mode_vel_limit = false; // taper the current beyond vel_limit in current control mode
         bool setpoints_in_cpr = false;
+        int32_t load_encoder_axis = -1; // Axis whose encoder provides the position feedback. -1 to use this axis' encoder.
+        float load_gear_ratio = 1.0f;   // [motor counts / load counts] only used if a load encoder is selected
+        // Electronic gearing/camming (CTRL_MODE_FOLLOW)
+        int32_t follow_axis = -1;       // axis to follow
+        FollowSource_t follow_source = FOLLOW_SOURCE_POS_ESTIMATE;
+        float follow_ratio = 1.0f;      // [counts / master counts]
+        bool cam_enable = false;        // map the master position through cam_table before applying follow_ratio
+        uint32_t cam_points = CAM_TABLE_SIZE; // number of used points in cam_table
+        float cam_period = 8192.0f;     // [master counts] the cam table repeats after this distance
+        float cam_table[CAM_TABLE_SIZE] = {0}; // [counts] equally spaced over cam_period
+        // Input shaping of the setpoints in position control modes
+        InputShaper::Type_t input_shaper_type = InputShaper::TYPE_NONE;
+        float input_shaper_freq = 10.0f;   // [Hz] resonance frequency
+        float input_shaper_damping = 0.0f; // damping ratio of the resonance
+        BiquadFilter::Config_t torque_filters[TORQUE_FILTER_COUNT]; // applied in series to the current command
+        // Disturbance observer: estimates the load current from the inertia model
+        bool disturbance_observer_enable = false;
+        float disturbance_observer_accel_per_amp = 100000.0f; // [(counts/s^2) / A] inverse of the inertia
+        float disturbance_observer_bandwidth = 200.0f;        // [rad/s]
+        float disturbance_observer_gain = 1.0f;               // fraction of the estimate fed forward in velocity control modes
+        AutotuneConfig_t autotune;
+        // Soft position limits [counts], in load counts if a load encoder is used
+        bool soft_limits_enable = false;
+        float soft_limit_min = -100000.0f;
+        float soft_limit_max = 100000.0f;
+        // Gain scheduling
+        bool gain_schedule_enable = false;
+        float gain_schedule_vel_step = 5000.0f; // [counts/s] spacing of the velocity breakpoints, starting at 0
+        GainScheduleParam_t gain_schedule_param_source = GAIN_SCHEDULE_PARAM_NONE;
+        float gain_schedule_param_step = 1.0f;  // spacing of the parameter breakpoints, starting at 0
+        GainScale_t gain_schedule[GAIN_SCHEDULE_PARAM_POINTS][GAIN_SCHEDULE_VEL_POINTS];
     };
 
     explicit Controller(Config_t& config);
@@ -45,11 +129,41 @@ public:
     // Trajectory-Planned control
     void move_to_pos(float goal_point);
     void move_incremental(float displacement, bool from_goal_point);
+    static bool move_coordinated(const float goal_points[AXIS_COUNT]);
+
+    // Streamed PVT control
+    bool push_pvt_point(float dt, float pos, float vel);
+    uint32_t append_pvt_points(uint32_t count,
+                               float dt0, float pos0, float vel0,
+                               float dt1, float pos1, float vel1,
+                               float dt2, float pos2, float vel2,
+                               float dt3, float pos3, float vel3);
+    void clear_pvt_buffer();
+    void update_pvt();
+
+    // Electronic gearing/camming
+    void set_cam_point(uint32_t index, float value);
+    float get_cam_point(uint32_t index);
+    bool update_follow();
+
+    void update_input_shaper() { input_shaper_dirty_ = true; }
+    void update_torque_filters() { torque_filters_dirty_ = true; }
+
+    // Gain scheduling
+    void update_gain_schedule();
+    void set_gain_schedule_point(uint32_t param_index, uint32_t vel_index,
+                                 float pos_gain_scale, float vel_gain_scale, float vel_integrator_gain_scale);
+    float get_gain_schedule_point(uint32_t param_index, uint32_t vel_index, uint32_t gain);
+    GainScale_t eval_gain_schedule(float vel_estimate);
     
     // TODO: make this more similar to other calibration loops
     void start_anticogging_calibration();
     bool anticogging_calibration(float pos_estimate, float vel_estimate);
 
+    bool run_autotune();
+
+    Encoder* load_encoder();
+    float load_vel_setpoint();
     bool update(float pos_estimate, float vel_estimate, float* current_setpoint);
 
     Config_t& config_;
@@ -63,7 +177,7 @@ public:
 
     typedef struct {
         int index;
-        float *cogging_map;
+        float *cogging_map; // ANTICOGGING_MAX_CPR entries, set in odrive_main
         bool use_anticogging;
         bool calib_anticogging;
         float calib_pos_threshold;
@@ -87,12 +201,69 @@ public:
     float current_setpoint_ = 0.0f;        // [A]
     float vel_ramp_target_ = 0.0f;
     bool vel_ramp_enable_ = false;
+    float current_ramp_target_ = 0.0f;     // [A]
+    bool current_ramp_enable_ = false;
+    float current_lim_ = 0.0f;             // [A] additional current limit (e.g. during homing), 0 to disable
 
     uint32_t traj_start_loop_count_ = 0;
+    bool traj_s_curve_ = false; // the active trajectory is axis_->s_curve_ instead of axis_->trap_
+    float traj_accel_ = 0.0f;   // [count/s^2] acceleration of the active trajectory
+
+    // PVT ring buffer: written by append_pvt_points, consumed by update()
+    PVTPoint_t pvt_buffer_[PVT_BUFFER_SIZE];
+    volatile uint32_t pvt_read_idx_ = 0;
+    volatile uint32_t pvt_write_idx_ = 0;
+    volatile uint32_t pvt_clear_idx_ = 0;        // write index at the time of clear_pvt_buffer
+    volatile bool pvt_clear_requested_ = false;  // handled by update(), which owns pvt_read_idx_
+    uint32_t pvt_buffer_fill_ = 0;
+    uint32_t pvt_underrun_count_ = 0;
+    bool pvt_underrun_ = false;
+    float pvt_t_ = 0.0f;    // [s] time into the current segment
+    float pvt_pos0_ = 0.0f; // [count] start of the current segment
+    float pvt_vel0_ = 0.0f; // [count/s]
+
+    bool following_ = false;
+    float follow_offset_ = 0.0f; // [count] captured when following starts to avoid a jump
+
+    InputShaper input_shaper_;
+    volatile bool input_shaper_dirty_ = true; // reconfigure input_shaper_ in the control loop
+    bool input_shaper_active_ = false;
+    float shaped_pos_setpoint_ = 0.0f; // [count] setpoint after input shaping
+
+    BiquadFilter torque_filters_[TORQUE_FILTER_COUNT];
+    volatile bool torque_filters_dirty_ = true; // reconfigure torque_filters_ in the control loop
+
+    bool disturbance_observer_active_ = false;
+    float disturbance_observer_state_ = 0.0f; // [A] load_current_estimate_ + bandwidth * vel / accel_per_amp
+    float last_Iq_ = 0.0f;                    // [A] current command of the previous cycle
+    float load_current_estimate_ = 0.0f;      // [A] current needed to overcome load torque and friction
+
+    float gain_schedule_param_ = 0.0f; // used with GAIN_SCHEDULE_PARAM_USER
+    // Reciprocals of the breakpoint spacings, updated on config change
+    float gain_schedule_inv_vel_step_ = 0.0f;
+    float gain_schedule_inv_param_step_ = 0.0f;
+
+    // Results of the last autotune
+    float autotune_accel_per_amp_ = 0.0f;    // [(counts/s^2) / A] inverse of the inertia
+    float autotune_viscous_friction_ = 0.0f; // [A / (counts/s)]
+    float autotune_coulomb_friction_ = 0.0f; // [A]
 
     float goal_point_ = 0.0f;
 
     // Communication protocol definitions
+    auto make_torque_filter_definitions(BiquadFilter::Config_t& config) {
+        return make_protocol_member_list(
+            make_protocol_property("type", &config.type,
+                [](void* ctx) { static_cast<Controller*>(ctx)->update_torque_filters(); }, this),
+            make_protocol_property("frequency", &config.frequency,
+                [](void* ctx) { static_cast<Controller*>(ctx)->update_torque_filters(); }, this),
+            make_protocol_property("q", &config.q,
+                [](void* ctx) { static_cast<Controller*>(ctx)->update_torque_filters(); }, this),
+            make_protocol_property("ratio", &config.ratio,
+                [](void* ctx) { static_cast<Controller*>(ctx)->update_torque_filters(); }, this)
+        );
+    }
+
     auto make_protocol_definitions() {
         return make_protocol_member_list(
             make_protocol_property("error", &error_),
@@ -102,6 +273,18 @@ public:
             make_protocol_property("current_setpoint", &current_setpoint_),
             make_protocol_property("vel_ramp_target", &vel_ramp_target_),
             make_protocol_property("vel_ramp_enable", &vel_ramp_enable_),
+            make_protocol_property("current_ramp_target", &current_ramp_target_),
+            make_protocol_property("current_ramp_enable", &current_ramp_enable_),
+            make_protocol_ro_property("pvt_buffer_fill", &pvt_buffer_fill_),
+            make_protocol_property("pvt_underrun_count", &pvt_underrun_count_),
+            make_protocol_ro_property("shaped_pos_setpoint", &shaped_pos_setpoint_),
+            make_protocol_ro_property("load_current_estimate", &load_current_estimate_),
+            make_protocol_property("gain_schedule_param", &gain_schedule_param_),
+            make_protocol_object("autotune",
+                make_protocol_ro_property("accel_per_amp", &autotune_accel_per_amp_),
+                make_protocol_ro_property("viscous_friction", &autotune_viscous_friction_),
+                make_protocol_ro_property("coulomb_friction", &autotune_coulomb_friction_)
+            ),
             make_protocol_object("config",
                 make_protocol_property("control_mode", &config_.control_mode),
                 make_protocol_property("pos_gain", &config_.pos_gain),
@@ -110,7 +293,48 @@ public:
                 make_protocol_property("vel_limit", &config_.vel_limit),
                 make_protocol_property("vel_limit_tolerance", &config_.vel_limit_tolerance),
                 make_protocol_property("vel_ramp_rate", &config_.vel_ramp_rate),
-                make_protocol_property("setpoints_in_cpr", &config_.setpoints_in_cpr)
+                make_protocol_property("current_ramp_rate", &config_.current_ramp_rate),
+                make_protocol_property("enable_current_mode_vel_limit", &config_.enable_current_mode_vel_limit),
+                make_protocol_property("setpoints_in_cpr", &config_.setpoints_in_cpr),
+                make_protocol_property("load_encoder_axis", &config_.load_encoder_axis),
+                make_protocol_property("load_gear_ratio", &config_.load_gear_ratio),
+                make_protocol_property("follow_axis", &config_.follow_axis),
+                make_protocol_property("follow_source", &config_.follow_source),
+                make_protocol_property("follow_ratio", &config_.follow_ratio),
+                make_protocol_property("cam_enable", &config_.cam_enable),
+                make_protocol_property("cam_points", &config_.cam_points),
+                make_protocol_property("cam_period", &config_.cam_period),
+                make_protocol_property("input_shaper_type", &config_.input_shaper_type,
+                    [](void* ctx) { static_cast<Controller*>(ctx)->update_input_shaper(); }, this),
+                make_protocol_property("input_shaper_freq", &config_.input_shaper_freq,
+                    [](void* ctx) { static_cast<Controller*>(ctx)->update_input_shaper(); }, this),
+                make_protocol_property("input_shaper_damping", &config_.input_shaper_damping,
+                    [](void* ctx) { static_cast<Controller*>(ctx)->update_input_shaper(); }, this),
+                make_protocol_object("torque_filter0", make_torque_filter_definitions(config_.torque_filters[0])),
+                make_protocol_object("torque_filter1", make_torque_filter_definitions(config_.torque_filters[1])),
+                make_protocol_object("torque_filter2", make_torque_filter_definitions(config_.torque_filters[2])),
+                make_protocol_object("torque_filter3", make_torque_filter_definitions(config_.torque_filters[3])),
+                make_protocol_property("disturbance_observer_enable", &config_.disturbance_observer_enable),
+                make_protocol_property("disturbance_observer_accel_per_amp", &config_.disturbance_observer_accel_per_amp),
+                make_protocol_property("disturbance_observer_bandwidth", &config_.disturbance_observer_bandwidth),
+                make_protocol_property("disturbance_observer_gain", &config_.disturbance_observer_gain),
+                make_protocol_object("autotune",
+                    make_protocol_property("current", &config_.autotune.current),
+                    make_protocol_property("vel", &config_.autotune.vel),
+                    make_protocol_property("travel", &config_.autotune.travel),
+                    make_protocol_property("duration", &config_.autotune.duration),
+                    make_protocol_property("bandwidth", &config_.autotune.bandwidth),
+                    make_protocol_property("damping", &config_.autotune.damping)
+                ),
+                make_protocol_property("soft_limits_enable", &config_.soft_limits_enable),
+                make_protocol_property("soft_limit_min", &config_.soft_limit_min),
+                make_protocol_property("soft_limit_max", &config_.soft_limit_max),
+                make_protocol_property("gain_schedule_enable", &config_.gain_schedule_enable),
+                make_protocol_property("gain_schedule_vel_step", &config_.gain_schedule_vel_step,
+                    [](void* ctx) { static_cast<Controller*>(ctx)->update_gain_schedule(); }, this),
+                make_protocol_property("gain_schedule_param_source", &config_.gain_schedule_param_source),
+                make_protocol_property("gain_schedule_param_step", &config_.gain_schedule_param_step,
+                    [](void* ctx) { static_cast<Controller*>(ctx)->update_gain_schedule(); }, this)
             ),
             make_protocol_function("set_pos_setpoint", *this, &Controller::set_pos_setpoint,
                 "pos_setpoint", "vel_feed_forward", "current_feed_forward"),
@@ -120,6 +344,16 @@ public:
                                    "current_setpoint"),
             make_protocol_function("move_to_pos", *this, &Controller::move_to_pos, "pos_setpoint"),
             make_protocol_function("move_incremental", *this, &Controller::move_incremental, "displacement", "from_goal_point"),
+            make_protocol_function("append_pvt_points", *this, &Controller::append_pvt_points, "count",
+                "dt0", "pos0", "vel0", "dt1", "pos1", "vel1",
+                "dt2", "pos2", "vel2", "dt3", "pos3", "vel3"),
+            make_protocol_function("clear_pvt_buffer", *this, &Controller::clear_pvt_buffer),
+            make_protocol_function("set_cam_point", *this, &Controller::set_cam_point, "index", "value"),
+            make_protocol_function("get_cam_point", *this, &Controller::get_cam_point, "index"),
+            make_protocol_function("set_gain_schedule_point", *this, &Controller::set_gain_schedule_point,
+                "param_index", "vel_index", "pos_gain_scale", "vel_gain_scale", "vel_integrator_gain_scale"),
+            make_protocol_function("get_gain_schedule_point", *this, &Controller::get_gain_schedule_point,
+                "param_index", "vel_index", "gain"),
             make_protocol_function("start_anticogging_calibration", *this, &Controller::start_anticogging_calibration)
         );
     }
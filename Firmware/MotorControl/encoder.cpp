@@ -8,6 +8,7 @@ Encoder::Encoder(const EncoderHardwareConfig_t& hw_config,
         config_(config)
 {
     update_pll_gains();
+    update_sincos_correction();
 
     if (config.pre_calibrated && (config.mode == Encoder::MODE_HALL || config.mode == Encoder::MODE_SINCOS)) {
         is_ready_ = true;
@@ -20,6 +21,18 @@ static void enc_index_cb_wrapper(void* ctx) {
 
 void Encoder::setup() {
     HAL_TIM_Encoder_Start(hw_config_.timer, TIM_CHANNEL_ALL);
+
+    // Latch the encoder count on the rising index edge in hardware
+    if (hw_config_.index_capture) {
+        TIM_IC_InitTypeDef sConfigIC;
+        sConfigIC.ICPolarity = TIM_ICPOLARITY_RISING;
+        sConfigIC.ICSelection = TIM_ICSELECTION_DIRECTTI;
+        sConfigIC.ICPrescaler = TIM_ICPSC_DIV1;
+        sConfigIC.ICFilter = 0;
+        HAL_TIM_IC_ConfigChannel(hw_config_.timer, &sConfigIC, hw_config_.index_capture_channel);
+        HAL_TIM_IC_Start(hw_config_.timer, hw_config_.index_capture_channel);
+    }
+
     set_idx_subscribe();
 }
 
@@ -41,9 +54,18 @@ bool Encoder::do_checks(){
 // (maybe by attaching the interrupt on start search, synergistic with following)
 void Encoder::enc_index_cb() {
     if (config_.use_index) {
-        set_circular_count(0, false);
+        // The encoder may have moved on since the index edge. If the count at
+        // the edge was captured in hardware, account for the counts since then.
+        int32_t count = 0;
+        if (hw_config_.index_capture) {
+            uint32_t captured = HAL_TIM_ReadCapturedValue(hw_config_.timer, hw_config_.index_capture_channel);
+            count = (int16_t)(hw_config_.timer->Instance->CNT - captured);
+        }
+        idx_capture_latency_ = count;
+
+        set_circular_count(count, false);
         if (config_.zero_count_on_find_idx)
-            set_linear_count(0); // Avoid position control transient after search
+            set_linear_count(count); // Avoid position control transient after search
         if (config_.pre_calibrated) {
             is_ready_ = true;
         } else {
@@ -63,21 +85,36 @@ void Encoder::set_idx_subscribe(bool override_enable) {
     if (config_.use_index && (override_enable || !config_.find_idx_on_lockin_only)) {
         GPIO_subscribe(hw_config_.index_port, hw_config_.index_pin, GPIO_PULLDOWN,
                 enc_index_cb_wrapper, this);
+        // Route the pin to the timer capture channel. The EXTI line stays
+        // armed because it is fed regardless of the pin mode.
+        if (hw_config_.index_capture && config_.mode == MODE_INCREMENTAL) {
+            GPIO_InitTypeDef GPIO_InitStruct;
+            GPIO_InitStruct.Pin = hw_config_.index_pin;
+            GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+            GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+            GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+            GPIO_InitStruct.Alternate = hw_config_.index_capture_af;
+            HAL_GPIO_Init(hw_config_.index_port, &GPIO_InitStruct);
+        }
     } else if (!config_.use_index || config_.find_idx_on_lockin_only) {
         GPIO_unsubscribe(hw_config_.index_port, hw_config_.index_pin);
     }
 }
 
 void Encoder::update_pll_gains() {
-    pll_kp_ = 2.0f * config_.bandwidth;  // basic conversion to discrete time
-    pll_ki_ = 0.25f * (pll_kp_ * pll_kp_); // Critically damped
-
     // Check that we don't get problems with discrete time approximation
-    if (!(current_meas_period * pll_kp_ < 1.0f)) {
+    if (!observer_.set_bandwidth(config_.observer_type, config_.bandwidth)) {
         set_error(ERROR_UNSTABLE_GAIN);
     }
 }
 
+// @brief Caches the terms of the sin/cos quadrature error correction.
+// This should be invoked whenever config_.sincos_phase changes.
+void Encoder::update_sincos_correction() {
+    sincos_phase_tan_ = tanf(config_.sincos_phase);
+    sincos_phase_sec_ = 1.0f / cosf(config_.sincos_phase);
+}
+
 void Encoder::check_pre_calibrated() {
     if (!is_ready_)
         config_.pre_calibrated = false;
@@ -92,6 +129,7 @@ void Encoder::set_linear_count(int32_t count) {
 
     // Update states
     shadow_count_ = count;
+    tim_cnt_sample_ = (int16_t)count; // the pending sample predates the new count
     pos_estimate_ = (float)count;
     //Write hardware last
     hw_config_.timer->Instance->CNT = count;
@@ -99,6 +137,18 @@ void Encoder::set_linear_count(int32_t count) {
     cpu_exit_critical(prim);
 }
 
+// @brief Returns the linear count at the time of the call. In incremental
+// mode the count is read directly from the timer, so this is exact when
+// called from an edge interrupt, instead of lagging by up to one control period.
+int32_t Encoder::capture_linear_count() {
+    if (config_.mode == MODE_INCREMENTAL) {
+        int32_t shadow_count = shadow_count_;
+        int16_t delta_enc_16 = (int16_t)hw_config_.timer->Instance->CNT - (int16_t)shadow_count;
+        return shadow_count + (int32_t)delta_enc_16;
+    }
+    return shadow_count_;
+}
+
 // Function that sets the CPR circular tracking encoder count to a desired 32-bit value.
 // Note that this will get mod'ed down to [0, cpr)
 void Encoder::set_circular_count(int32_t count, bool update_offset) {
@@ -262,6 +312,103 @@ bool Encoder::run_offset_calibration() {
     return true;
 }
 
+// @brief Turns the motor in one direction and then in the other direction
+// while recording the raw sin/cos signals of a SinCos encoder.
+// The forward scan determines the offset and amplitude of each channel,
+// the backward scan the quadrature (phase) error between the channels.
+// The scan must cover at least one full sine period.
+bool Encoder::run_sincos_calibration() {
+    const int num_steps = (int)(config_.calib_scan_distance / config_.calib_scan_omega * (float)current_meas_hz);
+
+    if (config_.mode != MODE_SINCOS) {
+        set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
+        return false;
+    }
+
+    float voltage_magnitude;
+    if (axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_HIGH_CURRENT)
+        voltage_magnitude = axis_->motor_.config_.calibration_current * axis_->motor_.config_.phase_resistance;
+    else if (axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_GIMBAL)
+        voltage_magnitude = axis_->motor_.config_.calibration_current;
+    else
+        return false;
+
+    // scan forward: record the extrema of each channel
+    float s_min = INFINITY, s_max = -INFINITY;
+    float c_min = INFINITY, c_max = -INFINITY;
+    int i = 0;
+    axis_->run_control_loop([&](){
+        float phase = wrap_pm_pi(config_.calib_scan_distance * (float)i / (float)num_steps - config_.calib_scan_distance / 2.0f);
+        float v_alpha = voltage_magnitude * our_arm_cos_f32(phase);
+        float v_beta = voltage_magnitude * our_arm_sin_f32(phase);
+        if (!axis_->motor_.enqueue_voltage_timings(v_alpha, v_beta))
+            return false; // error set inside enqueue_voltage_timings
+        axis_->motor_.log_timing(Motor::TIMING_LOG_ENC_CALIB);
+
+        s_min = std::min(s_min, sincos_sample_s_);
+        s_max = std::max(s_max, sincos_sample_s_);
+        c_min = std::min(c_min, sincos_sample_c_);
+        c_max = std::max(c_max, sincos_sample_c_);
+
+        return ++i < num_steps;
+    });
+    if (axis_->error_ != Axis::ERROR_NONE)
+        return false;
+
+    if (!(s_max - s_min >= config_.sincos_calib_min_amplitude) ||
+        !(c_max - c_min >= config_.sincos_calib_min_amplitude)) {
+        set_error(ERROR_SINCOS_CALIBRATION_FAILED);
+        return false;
+    }
+
+    float offset_s = 0.5f * (s_max + s_min);
+    float offset_c = 0.5f * (c_max + c_min);
+    float gain_s = 2.0f / (s_max - s_min);
+    float gain_c = 2.0f / (c_max - c_min);
+
+    // scan backwards: record the extrema of s+c and s-c
+    // With s = sin(theta) and c = cos(theta + phi), the amplitudes of these are
+    // A+^2 = 2 - 2*sin(phi) and A-^2 = 2 + 2*sin(phi).
+    float sum_min = INFINITY, sum_max = -INFINITY;
+    float diff_min = INFINITY, diff_max = -INFINITY;
+    i = 0;
+    axis_->run_control_loop([&](){
+        float phase = wrap_pm_pi(-config_.calib_scan_distance * (float)i / (float)num_steps + config_.calib_scan_distance / 2.0f);
+        float v_alpha = voltage_magnitude * our_arm_cos_f32(phase);
+        float v_beta = voltage_magnitude * our_arm_sin_f32(phase);
+        if (!axis_->motor_.enqueue_voltage_timings(v_alpha, v_beta))
+            return false; // error set inside enqueue_voltage_timings
+        axis_->motor_.log_timing(Motor::TIMING_LOG_ENC_CALIB);
+
+        float s = gain_s * (sincos_sample_s_ - offset_s);
+        float c = gain_c * (sincos_sample_c_ - offset_c);
+        sum_min = std::min(sum_min, s + c);
+        sum_max = std::max(sum_max, s + c);
+        diff_min = std::min(diff_min, s - c);
+        diff_max = std::max(diff_max, s - c);
+
+        return ++i < num_steps;
+    });
+    if (axis_->error_ != Axis::ERROR_NONE)
+        return false;
+
+    float sum_amplitude = 0.5f * (sum_max - sum_min);
+    float diff_amplitude = 0.5f * (diff_max - diff_min);
+    float sin_phase = 0.25f * (SQ(diff_amplitude) - SQ(sum_amplitude));
+    if (!(fabsf(sin_phase) < 0.5f)) { // more than 30deg quadrature error is not plausible
+        set_error(ERROR_SINCOS_CALIBRATION_FAILED);
+        return false;
+    }
+
+    config_.sincos_offset_s = offset_s;
+    config_.sincos_offset_c = offset_c;
+    config_.sincos_gain_s = gain_s;
+    config_.sincos_gain_c = gain_c;
+    config_.sincos_phase = asinf(sin_phase);
+    update_sincos_correction();
+    return true;
+}
+
 static bool decode_hall(uint8_t hall_state, int32_t* hall_cnt) {
     switch (hall_state) {
         case 0b001: *hall_cnt = 0; return true;
@@ -285,8 +432,7 @@ void Encoder::sample_now() {
         } break;
 
         case MODE_SINCOS: {
-            sincos_sample_s_ = (get_adc_voltage(GPIO_3_GPIO_Port, GPIO_3_Pin) / 3.3f) - 0.5f;
-            sincos_sample_c_ = (get_adc_voltage(GPIO_4_GPIO_Port, GPIO_4_Pin) / 3.3f) - 0.5f;
+            // do nothing: samples already captured by the injected ADC1 conversion
         } break;
 
         default: {
@@ -295,9 +441,10 @@ void Encoder::sample_now() {
     }
 }
 
-bool Encoder::update() {
+RAMFUNC bool Encoder::update() {
     // update internal encoder state.
     int32_t delta_enc = 0;
+    float sincos_interpolation = 0.0f;
     switch (config_.mode) {
         case MODE_INCREMENTAL: {
             //TODO: use count_in_cpr_ instead as shadow_count_ can overflow
@@ -322,14 +469,38 @@ bool Encoder::update() {
         } break;
 
         case MODE_SINCOS: {
-            float phase = fast_atan2(sincos_sample_s_, sincos_sample_c_);
-            int fake_count = (int)(1000.0f * phase);
-            //CPR = 6283 = 2pi * 1k
-
-            delta_enc = fake_count - count_in_cpr_;
-            delta_enc = mod(delta_enc, 6283);
-            if (delta_enc > 6283/2)
-                delta_enc -= 6283;
+            if (config_.sincos_periods < 1) {
+                set_error(ERROR_CPR_OUT_OF_RANGE);
+                return false;
+            }
+
+            // Normalize the samples and correct the quadrature error, such that
+            // s = sin(theta) and c = cos(theta)
+            float s = config_.sincos_gain_s * (sincos_sample_s_ - config_.sincos_offset_s);
+            float c = config_.sincos_gain_c * (sincos_sample_c_ - config_.sincos_offset_c);
+            c = sincos_phase_sec_ * c + sincos_phase_tan_ * s;
+
+            float period_frac = fast_atan2(s, c) * (0.5f / M_PI);
+            if (period_frac < 0.0f)
+                period_frac += 1.0f;
+
+            // Count periods: a wrap of the phase means we entered the neighbouring period
+            if (period_frac - sincos_period_frac_ < -0.5f)
+                sincos_period_ = mod(sincos_period_ + 1, config_.sincos_periods);
+            else if (period_frac - sincos_period_frac_ > 0.5f)
+                sincos_period_ = mod(sincos_period_ - 1, config_.sincos_periods);
+            sincos_period_frac_ = period_frac;
+
+            // Interpolate within the period
+            float counts_per_period = (float)config_.cpr / (float)config_.sincos_periods;
+            float count = ((float)sincos_period_ + period_frac) * counts_per_period;
+            int32_t sincos_count = std::min((int32_t)count, config_.cpr - 1);
+            sincos_interpolation = count - (float)sincos_count;
+
+            delta_enc = sincos_count - sincos_count_;
+            delta_enc = mod(delta_enc, config_.cpr);
+            if (delta_enc > config_.cpr/2)
+                delta_enc -= config_.cpr;
         } break;
         
         default: {
@@ -338,33 +509,77 @@ bool Encoder::update() {
         } break;
     }
 
+    //// check signal integrity
+    // Compare the count step to the one predicted by the velocity estimate.
+    // Hall and sin/cos samples are absolute, so an implausible step is held
+    // off: the count stays and the step is seen again next period. A step
+    // that persists for max_glitch_run periods is real (e.g. a fast
+    // acceleration) and is accepted, so that the position estimate can't
+    // freeze on a stale count.
+    // The incremental counter accumulates every edge, so holding off would
+    // only apply the same delta later in one lump. There the step is always
+    // accepted and only counted towards the glitch rate.
+    static const float noise_tau = 0.1f;  // [s]
+    static const float glitch_tau = 1.0f; // [s]
+    static const uint32_t max_glitch_run = 8;
+    float deviation = fabsf((float)delta_enc - current_meas_period * vel_estimate_);
+    noise_ += (current_meas_period / noise_tau) * (deviation - noise_);
+    glitch_rate_ -= (current_meas_period / glitch_tau) * glitch_rate_;
+    if (config_.glitch_tolerance > 0.0f && deviation > config_.glitch_tolerance) {
+        glitch_count_++;
+        // at most one glitch per period
+        glitch_rate_ = std::min(glitch_rate_ + 1.0f / glitch_tau, (float)current_meas_hz);
+        if (config_.max_glitch_rate > 0.0f && glitch_rate_ > config_.max_glitch_rate) {
+            set_error(ERROR_SIGNAL_GLITCHES);
+            return false;
+        }
+        if (config_.mode == MODE_INCREMENTAL)
+            glitch_run_ = 0;
+        else if (++glitch_run_ < max_glitch_run)
+            delta_enc = 0;
+        else
+            glitch_run_ = 0;
+    } else {
+        glitch_run_ = 0;
+    }
+
+    if (config_.mode == MODE_SINCOS)
+        sincos_count_ = mod(sincos_count_ + delta_enc, config_.cpr);
     shadow_count_ += delta_enc;
     count_in_cpr_ += delta_enc;
     count_in_cpr_ = mod(count_in_cpr_, config_.cpr);
 
-    //// run pll (for now pll is in units of encoder counts)
-    // Predict current pos
-    pos_estimate_ += current_meas_period * vel_estimate_;
-    pos_cpr_      += current_meas_period * vel_estimate_;
+    //// run observer (in units of encoder counts)
+    // Predict current pos, using the torque applied during the last period.
+    // Iq_setpoint includes the motor direction, undo it to get the encoder frame.
+    float Iq = (float)axis_->motor_.config_.direction * axis_->motor_.current_control_.Iq_setpoint;
+    float accel_input = config_.observer_accel_per_amp * Iq;
+    float delta_pos_pred = observer_.predict(accel_input);
+    pos_estimate_ += delta_pos_pred;
+    pos_cpr_      += delta_pos_pred;
     // discrete phase detector
     float delta_pos     = (float)(shadow_count_ - (int32_t)floorf(pos_estimate_));
     float delta_pos_cpr = (float)(count_in_cpr_ - (int32_t)floorf(pos_cpr_));
     delta_pos_cpr = wrap_pm(delta_pos_cpr, 0.5f * (float)(config_.cpr));
-    // pll feedback
-    pos_estimate_ += current_meas_period * pll_kp_ * delta_pos;
-    pos_cpr_      += current_meas_period * pll_kp_ * delta_pos_cpr;
+    // observer feedback
+    pos_estimate_ += observer_.pos_correction(delta_pos);
+    pos_cpr_      += observer_.correct(delta_pos_cpr);
     pos_cpr_ = fmodf_pos(pos_cpr_, (float)(config_.cpr));
-    vel_estimate_      += current_meas_period * pll_ki_ * delta_pos_cpr;
     bool snap_to_zero_vel = false;
-    if (fabsf(vel_estimate_) < 0.5f * current_meas_period * pll_ki_) {
-        vel_estimate_ = 0.0f; //align delta-sigma on zero to prevent jitter
+    if (fabsf(observer_.vel_estimate_) < 0.5f * observer_.vel_gain_) {
+        observer_.vel_estimate_ = 0.0f; //align delta-sigma on zero to prevent jitter
+        observer_.accel_estimate_ = 0.0f;
         snap_to_zero_vel = true;
     }
+    vel_estimate_ = observer_.vel_estimate_;
 
     //// run encoder count interpolation
     int32_t corrected_enc = count_in_cpr_ - config_.offset;
+    // SinCos encoders measure the position inside the count directly
+    if (config_.mode == MODE_SINCOS) {
+        interpolation_ = sincos_interpolation;
     // if we are stopped, make sure we don't randomly drift
-    if (snap_to_zero_vel || !config_.enable_phase_interpolation) {
+    } else if (snap_to_zero_vel || !config_.enable_phase_interpolation) {
         interpolation_ = 0.5f;
     // reset interpolation if encoder edge comes
     } else if (delta_enc > 0) {
@@ -15,6 +15,8 @@ public:
         ERROR_UNSUPPORTED_ENCODER_MODE = 0x08,
         ERROR_ILLEGAL_HALL_STATE = 0x10,
         ERROR_INDEX_NOT_FOUND_YET = 0x20,
+        ERROR_SINCOS_CALIBRATION_FAILED = 0x40,
+        ERROR_SIGNAL_GLITCHES = 0x80,
     };
 
     enum Mode_t {
@@ -40,9 +42,22 @@ public:
         float calib_scan_distance = 16.0f * M_PI; // rad electrical
         float calib_scan_omega = 4.0f * M_PI; // rad/s electrical
         float bandwidth = 1000.0f;
+        Observer::Type_t observer_type = Observer::TYPE_PLL;
+        float observer_accel_per_amp = 0.0f; // [(count/s^2) / A] Iq feed-forward into the observer, 0 to disable
         bool find_idx_on_lockin_only = false; // Only be sensitive during lockin scan constant vel state
         bool idx_search_unidirectional = false; // Only allow index search in known direction
         bool ignore_illegal_hall_state = false; // dont error on bad states like 000 or 111
+        // SinCos encoder settings. cpr is the interpolated resolution over one
+        // revolution, i.e. each sine period is divided into cpr / sincos_periods counts.
+        int32_t sincos_periods = 1;       // number of sine periods per revolution
+        float sincos_offset_s = 0.5f;     // [fraction of ADC full scale] set by run_sincos_calibration
+        float sincos_offset_c = 0.5f;     // [fraction of ADC full scale]
+        float sincos_gain_s = 2.0f;       // [1/fraction of ADC full scale] normalizes amplitude to 1
+        float sincos_gain_c = 2.0f;       // [1/fraction of ADC full scale]
+        float sincos_phase = 0.0f;        // [rad] quadrature error of the cos channel
+        float sincos_calib_min_amplitude = 0.05f; // [fraction of ADC full scale] peak-peak required to pass calibration
+        float glitch_tolerance = 0.0f; // [count] max deviation of a count step from the predicted step, 0 disables glitch rejection
+        float max_glitch_rate = 10.0f; // [1/s] rate of implausible steps above which ERROR_SIGNAL_GLITCHES is set, 0 to disable
     };
 
     Encoder(const EncoderHardwareConfig_t& hw_config,
@@ -55,15 +70,18 @@ public:
     void enc_index_cb();
     void set_idx_subscribe(bool override_enable = false);
     void update_pll_gains();
+    void update_sincos_correction();
     void check_pre_calibrated();
 
     void set_linear_count(int32_t count);
+    int32_t capture_linear_count();
     void set_circular_count(int32_t count, bool update_offset);
     bool calib_enc_offset(float voltage_magnitude);
 
     bool run_index_search();
     bool run_direction_find();
     bool run_offset_calibration();
+    bool run_sincos_calibration();
     void sample_now();
     bool update();
 
@@ -75,6 +93,7 @@ public:
 
     Error_t error_ = ERROR_NONE;
     bool index_found_ = false;
+    int32_t idx_capture_latency_ = 0; // [counts] encoder movement between the index edge and its interrupt
     bool is_ready_ = false;
     int32_t shadow_count_ = 0;
     int32_t count_in_cpr_ = 0;
@@ -83,15 +102,24 @@ public:
     float pos_estimate_ = 0.0f;  // [count]
     float pos_cpr_ = 0.0f;  // [count]
     float vel_estimate_ = 0.0f;  // [count/s]
-    float pll_kp_ = 0.0f;   // [count/s / count]
-    float pll_ki_ = 0.0f;   // [(count/s^2) / count]
+    float noise_ = 0.0f;         // [count] filtered mean deviation of the count steps from the prediction
+    float glitch_rate_ = 0.0f;   // [1/s] filtered rate of implausible count steps
+    uint32_t glitch_count_ = 0;  // total number of implausible count steps
+    uint32_t glitch_run_ = 0;    // number of consecutive held off count steps
+    Observer observer_;
     float calib_scan_response_ = 0.0f; // debug report from offset calib
 
     int16_t tim_cnt_sample_ = 0; // 
     // Updated by low_level pwm_adc_cb
     uint8_t hall_state_ = 0x0; // bit[0] = HallA, .., bit[2] = HallC
-    float sincos_sample_s_ = 0.0f;
-    float sincos_sample_c_ = 0.0f;
+    // Updated by low_level vbus_sense_adc_cb
+    float sincos_sample_s_ = 0.5f; // [fraction of ADC full scale]
+    float sincos_sample_c_ = 0.5f; // [fraction of ADC full scale]
+    float sincos_phase_tan_ = 0.0f; // cached by update_sincos_correction
+    float sincos_phase_sec_ = 1.0f; // cached by update_sincos_correction
+    int32_t sincos_period_ = 0;     // sine period within the revolution [0, sincos_periods)
+    float sincos_period_frac_ = 0.0f; // phase within the sine period [0, 1)
+    int32_t sincos_count_ = 0;      // interpolated count within the revolution [0, cpr)
 
     // Communication protocol definitions
     auto make_protocol_definitions() {
@@ -99,6 +127,7 @@ public:
             make_protocol_property("error", &error_),
             make_protocol_property("is_ready", &is_ready_),
             make_protocol_property("index_found", const_cast<bool*>(&index_found_)),
+            make_protocol_ro_property("idx_capture_latency", &idx_capture_latency_),
             make_protocol_property("shadow_count", &shadow_count_),
             make_protocol_property("count_in_cpr", &count_in_cpr_),
             make_protocol_property("interpolation", &interpolation_),
@@ -106,10 +135,15 @@ public:
             make_protocol_property("pos_estimate", &pos_estimate_),
             make_protocol_property("pos_cpr", &pos_cpr_),
             make_protocol_ro_property("hall_state", &hall_state_),
-            make_protocol_property("vel_estimate", &vel_estimate_),
+            make_protocol_ro_property("vel_estimate", &vel_estimate_),
             make_protocol_ro_property("calib_scan_response", &calib_scan_response_),
-            // make_protocol_property("pll_kp", &pll_kp_),
-            // make_protocol_property("pll_ki", &pll_ki_),
+            make_protocol_ro_property("sincos_sample_s", &sincos_sample_s_),
+            make_protocol_ro_property("sincos_sample_c", &sincos_sample_c_),
+            make_protocol_ro_property("sincos_period", &sincos_period_),
+            make_protocol_ro_property("accel_estimate", &observer_.accel_estimate_),
+            make_protocol_ro_property("noise", &noise_),
+            make_protocol_ro_property("glitch_rate", &glitch_rate_),
+            make_protocol_property("glitch_count", &glitch_count_),
             make_protocol_object("config",
                 make_protocol_property("mode", &config_.mode),
                 make_protocol_property("use_index", &config_.use_index,
@@ -125,11 +159,24 @@ public:
                 make_protocol_property("enable_phase_interpolation", &config_.enable_phase_interpolation),
                 make_protocol_property("bandwidth", &config_.bandwidth,
                     [](void* ctx) { static_cast<Encoder*>(ctx)->update_pll_gains(); }, this),
+                make_protocol_property("observer_type", &config_.observer_type,
+                    [](void* ctx) { static_cast<Encoder*>(ctx)->update_pll_gains(); }, this),
+                make_protocol_property("observer_accel_per_amp", &config_.observer_accel_per_amp),
                 make_protocol_property("calib_range", &config_.calib_range),
                 make_protocol_property("calib_scan_distance", &config_.calib_scan_distance),
                 make_protocol_property("calib_scan_omega", &config_.calib_scan_omega),
                 make_protocol_property("idx_search_unidirectional", &config_.idx_search_unidirectional),
-                make_protocol_property("ignore_illegal_hall_state", &config_.ignore_illegal_hall_state)
+                make_protocol_property("ignore_illegal_hall_state", &config_.ignore_illegal_hall_state),
+                make_protocol_property("sincos_periods", &config_.sincos_periods),
+                make_protocol_property("sincos_offset_s", &config_.sincos_offset_s),
+                make_protocol_property("sincos_offset_c", &config_.sincos_offset_c),
+                make_protocol_property("sincos_gain_s", &config_.sincos_gain_s),
+                make_protocol_property("sincos_gain_c", &config_.sincos_gain_c),
+                make_protocol_property("sincos_phase", &config_.sincos_phase,
+                    [](void* ctx) { static_cast<Encoder*>(ctx)->update_sincos_correction(); }, this),
+                make_protocol_property("sincos_calib_min_amplitude", &config_.sincos_calib_min_amplitude),
+                make_protocol_property("glitch_tolerance", &config_.glitch_tolerance),
+                make_protocol_property("max_glitch_rate", &config_.max_glitch_rate)
             ),
             make_protocol_function("set_linear_count", *this, &Encoder::set_linear_count, "count")
         );
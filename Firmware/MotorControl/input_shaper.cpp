@@ -0,0 +1,103 @@
+
+#include "odrive_main.h"
+
+// @brief Computes the impulse sequence for a resonance at the given
+// frequency [Hz] and damping ratio.
+// Returns false if the parameters are invalid, in which case shaping is disabled.
+bool InputShaper::configure(Type_t type, float frequency, float damping) {
+    type_ = TYPE_NONE;
+    num_impulses_ = 0;
+    if (type == TYPE_NONE)
+        return true;
+    if (!(frequency > 0.0f) || !(damping >= 0.0f && damping < 1.0f))
+        return false;
+
+    float sqrt_1_zeta2 = sqrtf(1.0f - SQ(damping));
+    float half_period = 0.5f / (frequency * sqrt_1_zeta2); // [s] half damped period
+    float K = expf(-damping * M_PI / sqrt_1_zeta2);
+    float t[MAX_IMPULSES];
+
+    switch (type) {
+        case TYPE_ZV: {
+            num_impulses_ = 2;
+            amplitudes_[0] = 1.0f / (1.0f + K);
+            amplitudes_[1] = K / (1.0f + K);
+            t[0] = 0.0f;
+            t[1] = half_period;
+        } break;
+        case TYPE_ZVD: {
+            num_impulses_ = 3;
+            float norm = 1.0f / SQ(1.0f + K);
+            amplitudes_[0] = norm;
+            amplitudes_[1] = 2.0f * K * norm;
+            amplitudes_[2] = SQ(K) * norm;
+            t[0] = 0.0f;
+            t[1] = half_period;
+            t[2] = 2.0f * half_period;
+        } break;
+        case TYPE_EI: {
+            static const float V = 0.05f; // tolerable residual vibration
+            num_impulses_ = 3;
+            amplitudes_[0] = 0.25f * (1.0f + V);
+            amplitudes_[1] = 0.5f * (1.0f - V);
+            amplitudes_[2] = 0.25f * (1.0f + V);
+            t[0] = 0.0f;
+            t[1] = half_period;
+            t[2] = 2.0f * half_period;
+        } break;
+        default:
+            return false;
+    }
+
+    // Choose the decimation such that the longest delay fits in the history
+    float max_delay = t[num_impulses_ - 1] * (float)current_meas_hz; // [control periods]
+    decimation_ = std::max(1, (int)ceilf(max_delay / (float)(HISTORY_SIZE - 2)));
+    for (size_t i = 0; i < num_impulses_; ++i)
+        delays_[i] = t[i] * (float)current_meas_hz / (float)decimation_;
+
+    type_ = type;
+    return true;
+}
+
+// @brief Fills the history with a constant value, such that the output starts at that value.
+void InputShaper::reset(const float in[NUM_CHANNELS]) {
+    for (size_t i = 0; i < HISTORY_SIZE; ++i)
+        for (size_t ch = 0; ch < NUM_CHANNELS; ++ch)
+            history_[i][ch] = in[ch];
+    decimation_count_ = 0;
+}
+
+void InputShaper::update(const float in[NUM_CHANNELS], float out[NUM_CHANNELS]) {
+    if (type_ == TYPE_NONE) {
+        for (size_t ch = 0; ch < NUM_CHANNELS; ++ch)
+            out[ch] = in[ch];
+        return;
+    }
+
+    if (++decimation_count_ >= decimation_) {
+        decimation_count_ = 0;
+        head_ = (head_ + 1) % HISTORY_SIZE;
+        for (size_t ch = 0; ch < NUM_CHANNELS; ++ch)
+            history_[head_][ch] = in[ch];
+    }
+
+    // The first impulse is never delayed
+    for (size_t ch = 0; ch < NUM_CHANNELS; ++ch)
+        out[ch] = amplitudes_[0] * in[ch];
+
+    // The newest history sample was taken decimation_count_ control periods
+    // ago. Account for that, so that the delayed signals are interpolated
+    // at the control rate instead of stepping once per history sample.
+    float phase = (float)decimation_count_ / (float)decimation_; // [history samples]
+    for (size_t i = 1; i < num_impulses_; ++i) {
+        float delay = std::max(delays_[i] - phase, 0.0f);
+        size_t age = (size_t)delay;
+        float frac = delay - (float)age;
+        size_t idx0 = (head_ + HISTORY_SIZE - age) % HISTORY_SIZE;
+        size_t idx1 = (idx0 + HISTORY_SIZE - 1) % HISTORY_SIZE;
+        for (size_t ch = 0; ch < NUM_CHANNELS; ++ch) {
+            float delayed = history_[idx0][ch] + frac * (history_[idx1][ch] - history_[idx0][ch]);
+            out[ch] += amplitudes_[i] * delayed;
+        }
+    }
+}
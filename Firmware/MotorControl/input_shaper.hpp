@@ -0,0 +1,41 @@
+#ifndef __INPUT_SHAPER_HPP
+#define __INPUT_SHAPER_HPP
+
+#ifndef __ODRIVE_MAIN_H
+#error "This file should not be included directly. Include odrive_main.h instead."
+#endif
+
+// Convolves a set of setpoint signals with a ZV, ZVD or EI impulse sequence
+// to cancel the excitation of a resonance.
+// The delay line is decimated so that the fixed-size history covers the
+// impulse sequence of any frequency. Delayed samples are linearly interpolated.
+class InputShaper {
+public:
+    enum Type_t {
+        TYPE_NONE = 0,
+        TYPE_ZV = 1,  // zero vibration: 2 impulses over half a period
+        TYPE_ZVD = 2, // zero vibration and derivative: 3 impulses over one period
+        TYPE_EI = 3,  // extra insensitive (5% vibration tolerance, undamped design): 3 impulses over one period
+    };
+
+    static constexpr size_t NUM_CHANNELS = 3;
+    static constexpr size_t MAX_IMPULSES = 3;
+    static constexpr size_t HISTORY_SIZE = 128;
+
+    bool configure(Type_t type, float frequency, float damping);
+    void reset(const float in[NUM_CHANNELS]);
+    void update(const float in[NUM_CHANNELS], float out[NUM_CHANNELS]);
+
+    Type_t type_ = TYPE_NONE;
+
+private:
+    size_t num_impulses_ = 0;
+    float amplitudes_[MAX_IMPULSES];
+    float delays_[MAX_IMPULSES]; // [history samples]
+    uint32_t decimation_ = 1;    // control periods per history sample
+    uint32_t decimation_count_ = 0;
+    size_t head_ = 0;            // index of the newest history sample
+    float history_[HISTORY_SIZE][NUM_CHANNELS];
+};
+
+#endif // __INPUT_SHAPER_HPP
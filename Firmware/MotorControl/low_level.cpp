@@ -41,8 +41,10 @@ static const GPIO_TypeDef* GPIOs_to_samp[] = { GPIOA, GPIOB, GPIOC };
 static const int num_GPIO = sizeof(GPIOs_to_samp) / sizeof(GPIOs_to_samp[0]); 
 /* Private variables ---------------------------------------------------------*/
 
-// Two motors, sampling port A,B,C (coherent with current meas timing)
-static uint16_t GPIO_port_samples [2][num_GPIO];
+// One sample of port A,B,C per axis (coherent with current meas timing)
+static uint16_t GPIO_port_samples [AXIS_COUNT][num_GPIO];
+// Counts the step input pulses if the hardware step counter is in use
+static TIM_HandleTypeDef htim_step_counter;
 /* CPU critical section helpers ----------------------------------------------*/
 
 /* Safety critical functions -------------------------------------------------*/
@@ -95,12 +97,17 @@ void low_level_fault(Motor::Error_t error) {
 // @brief Kicks off the arming process of the motor.
 // All calls to this function must clearly originate
 // from user input.
-void safety_critical_arm_motor_pwm(Motor& motor) {
+// Arming is refused while the NVM thread erases the flash, which would stall
+// the control loop with the PWM running.
+// @returns false if arming was refused because of a flash erase
+bool safety_critical_arm_motor_pwm(Motor& motor) {
     uint32_t mask = cpu_enter_critical();
-    if (brake_resistor_armed) {
+    bool refused = nvm_erase_in_progress_;
+    if (brake_resistor_armed && !refused) {
         motor.armed_state_ = Motor::ARMED_STATE_WAITING_FOR_TIMINGS;
     }
     cpu_exit_critical(mask);
+    return !refused;
 }
 
 // @brief Disarms the motor PWM.
@@ -122,7 +129,7 @@ bool safety_critical_disarm_motor_pwm(Motor& motor) {
 // If this is called at a rate higher than the motor's timer period,
 // the actual PMW timings on the pins can be undefined for up to one
 // timer period.
-void safety_critical_apply_motor_pwm_timings(Motor& motor, uint16_t timings[3]) {
+RAMFUNC void safety_critical_apply_motor_pwm_timings(Motor& motor, uint16_t timings[3]) {
     uint32_t mask = cpu_enter_critical();
     if (!brake_resistor_armed) {
         motor.armed_state_ = Motor::ARMED_STATE_DISARMED;
@@ -204,10 +211,13 @@ void start_adc_pwm() {
     // Warp field stabilize.
     osDelay(2);
     __HAL_ADC_ENABLE_IT(&hadc1, ADC_IT_JEOC);
-    __HAL_ADC_ENABLE_IT(&hadc2, ADC_IT_JEOC);
-    __HAL_ADC_ENABLE_IT(&hadc3, ADC_IT_JEOC);
-    __HAL_ADC_ENABLE_IT(&hadc2, ADC_IT_EOC);
-    __HAL_ADC_ENABLE_IT(&hadc3, ADC_IT_EOC);
+    for (size_t i = 0; i < CURRENT_MEAS_TRIGGER_COUNT; ++i) {
+        uint32_t it = current_meas_triggers[i].injected ? ADC_IT_JEOC : ADC_IT_EOC;
+        // ADC2 also loads the PWM timings, ADC3 is only needed to sample an axis
+        __HAL_ADC_ENABLE_IT(&hadc2, it);
+        if (current_meas_triggers[i].axis < AXIS_COUNT)
+            __HAL_ADC_ENABLE_IT(&hadc3, it);
+    }
 
     // Ensure that debug halting of the core doesn't leave the motor PWM running
     __HAL_DBGMCU_FREEZE_TIM1();
@@ -223,9 +233,12 @@ void start_adc_pwm() {
     __HAL_TIM_MOE_DISABLE_UNCONDITIONALLY(&htim1);
     __HAL_TIM_MOE_DISABLE_UNCONDITIONALLY(&htim8);
 
-    // Enable the update interrupt (used to coherently sample GPIO)
-    __HAL_TIM_ENABLE_IT(&htim1, TIM_IT_UPDATE);
-    __HAL_TIM_ENABLE_IT(&htim8, TIM_IT_UPDATE);
+    // Enable the update interrupt (used to coherently sample GPIO) of the
+    // timers that drive an axis
+    for (size_t i = 0; i < CURRENT_MEAS_TRIGGER_COUNT; ++i) {
+        if (current_meas_triggers[i].axis < AXIS_COUNT)
+            __HAL_TIM_ENABLE_IT(current_meas_triggers[i].timer, TIM_IT_UPDATE);
+    }
 
     // Start brake resistor PWM in floating output configuration
     htim2.Instance->CCR3 = 0;
@@ -311,6 +324,49 @@ void sync_timers(TIM_HandleTypeDef* htim_a, TIM_HandleTypeDef* htim_b,
     htim_b->Instance->BDTR |= MOE_store_b;
 }
 
+// @brief Returns the ADC1 channel number associated with the specified pin
+// or UINT32_MAX if the pin has no associated ADC1 channel.
+static uint32_t get_adc_channel(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin) {
+    uint32_t channel = UINT32_MAX;
+    if (GPIO_port == GPIOA) {
+        if (GPIO_pin == GPIO_PIN_0)
+            channel = 0;
+        else if (GPIO_pin == GPIO_PIN_1)
+            channel = 1;
+        else if (GPIO_pin == GPIO_PIN_2)
+            channel = 2;
+        else if (GPIO_pin == GPIO_PIN_3)
+            channel = 3;
+        else if (GPIO_pin == GPIO_PIN_4)
+            channel = 4;
+        else if (GPIO_pin == GPIO_PIN_5)
+            channel = 5;
+        else if (GPIO_pin == GPIO_PIN_6)
+            channel = 6;
+        else if (GPIO_pin == GPIO_PIN_7)
+            channel = 7;
+    } else if (GPIO_port == GPIOB) {
+        if (GPIO_pin == GPIO_PIN_0)
+            channel = 8;
+        else if (GPIO_pin == GPIO_PIN_1)
+            channel = 9;
+    } else if (GPIO_port == GPIOC) {
+        if (GPIO_pin == GPIO_PIN_0)
+            channel = 10;
+        else if (GPIO_pin == GPIO_PIN_1)
+            channel = 11;
+        else if (GPIO_pin == GPIO_PIN_2)
+            channel = 12;
+        else if (GPIO_pin == GPIO_PIN_3)
+            channel = 13;
+        else if (GPIO_pin == GPIO_PIN_4)
+            channel = 14;
+        else if (GPIO_pin == GPIO_PIN_5)
+            channel = 15;
+    }
+    return channel;
+}
+
 // @brief ADC1 measurements are written to this buffer by DMA
 uint16_t adc_measurements_[ADC_CHANNEL_COUNT] = { 0 };
 
@@ -321,10 +377,12 @@ uint16_t adc_measurements_[ADC_CHANNEL_COUNT] = { 0 };
 // round-robin fashion.
 // DMA is used to copy the measured 12-bit values to adc_measurements_.
 //
-// The injected (high priority) channel of ADC1 is used to sample vbus_voltage.
-// This conversion is triggered by TIM1 at the frequency of the motor control loop.
+// The injected (high priority) channels of ADC1 are used to sample vbus_voltage
+// and the GPIO_3/GPIO_4 pins (sin/cos inputs of a SinCos encoder).
+// These conversions are triggered by TIM1 at the frequency of the motor control loop.
 void start_general_purpose_adc() {
     ADC_ChannelConfTypeDef sConfig;
+    ADC_InjectionConfTypeDef sConfigInjected;
 
     // Configure the global features of the ADC (Clock, Resolution, Data Alignment and number of conversion)
     hadc1.Instance = ADC1;
@@ -353,6 +411,28 @@ void start_general_purpose_adc() {
             _Error_Handler((char*)__FILE__, __LINE__);
     }
 
+    // Set up injected sequence (vbus, GPIO_3, GPIO_4)
+    // Note that the rank layout in the JSQR register depends on the sequence
+    // length, so all ranks must be (re)configured with the final length.
+    uint32_t injected_channels[] = {
+        get_adc_channel(VBUS_S_GPIO_Port, VBUS_S_Pin),
+        get_adc_channel(GPIO_3_GPIO_Port, GPIO_3_Pin),
+        get_adc_channel(GPIO_4_GPIO_Port, GPIO_4_Pin)
+    };
+    sConfigInjected.InjectedNbrOfConversion = sizeof(injected_channels) / sizeof(injected_channels[0]);
+    sConfigInjected.InjectedSamplingTime = ADC_SAMPLETIME_15CYCLES;
+    sConfigInjected.ExternalTrigInjecConvEdge = ADC_EXTERNALTRIGINJECCONVEDGE_RISING;
+    sConfigInjected.ExternalTrigInjecConv = ADC_EXTERNALTRIGINJECCONV_T1_TRGO;
+    sConfigInjected.AutoInjectedConv = DISABLE;
+    sConfigInjected.InjectedDiscontinuousConvMode = DISABLE;
+    sConfigInjected.InjectedOffset = 0;
+    for (uint32_t rank = 0; rank < sConfigInjected.InjectedNbrOfConversion; ++rank) {
+        sConfigInjected.InjectedChannel = injected_channels[rank] << ADC_CR1_AWDCH_Pos;
+        sConfigInjected.InjectedRank = rank + 1; // rank numbering starts at 1
+        if (HAL_ADCEx_InjectedConfigChannel(&hadc1, &sConfigInjected) != HAL_OK)
+            _Error_Handler((char*)__FILE__, __LINE__);
+    }
+
     HAL_ADC_Start_DMA(&hadc1, reinterpret_cast<uint32_t*>(adc_measurements_), ADC_CHANNEL_COUNT);
 }
 
@@ -374,43 +454,7 @@ void start_general_purpose_adc() {
 // The true frequency is slightly lower because of the injected vbus
 // measurements
 float get_adc_voltage(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin) {
-    uint32_t channel = UINT32_MAX;
-    if (GPIO_port == GPIOA) {
-        if (GPIO_pin == GPIO_PIN_0)
-            channel = 0;
-        else if (GPIO_pin == GPIO_PIN_1)
-            channel = 1;
-        else if (GPIO_pin == GPIO_PIN_2)
-            channel = 2;
-        else if (GPIO_pin == GPIO_PIN_3)
-            channel = 3;
-        else if (GPIO_pin == GPIO_PIN_4)
-            channel = 4;
-        else if (GPIO_pin == GPIO_PIN_5)
-            channel = 5;
-        else if (GPIO_pin == GPIO_PIN_6)
-            channel = 6;
-        else if (GPIO_pin == GPIO_PIN_7)
-            channel = 7;
-    } else if (GPIO_port == GPIOB) {
-        if (GPIO_pin == GPIO_PIN_0)
-            channel = 8;
-        else if (GPIO_pin == GPIO_PIN_1)
-            channel = 9;
-    } else if (GPIO_port == GPIOC) {
-        if (GPIO_pin == GPIO_PIN_0)
-            channel = 10;
-        else if (GPIO_pin == GPIO_PIN_1)
-            channel = 11;
-        else if (GPIO_pin == GPIO_PIN_2)
-            channel = 12;
-        else if (GPIO_pin == GPIO_PIN_3)
-            channel = 13;
-        else if (GPIO_pin == GPIO_PIN_4)
-            channel = 14;
-        else if (GPIO_pin == GPIO_PIN_5)
-            channel = 15;
-    }
+    uint32_t channel = get_adc_channel(GPIO_port, GPIO_pin);
     if (channel < ADC_CHANNEL_COUNT)
         return ((float)adc_measurements_[channel]) * (adc_ref_voltage / adc_full_scale);
     else
@@ -423,17 +467,33 @@ float get_adc_voltage(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin) {
 
 void vbus_sense_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
     static const float voltage_scale = adc_ref_voltage * VBUS_S_DIVIDER_RATIO / adc_full_scale;
-    // Only one conversion in sequence, so only rank1
+    // Rank 1 is vbus, rank 2 and 3 are GPIO_3 and GPIO_4 (see start_general_purpose_adc)
     uint32_t ADCValue = HAL_ADCEx_InjectedGetValue(hadc, ADC_INJECTED_RANK_1);
     vbus_voltage = ADCValue * voltage_scale;
-    if (axes[0] && !axes[0]->error_ && axes[1] && !axes[1]->error_) {
+
+    // Hand the PWM-synchronous GPIO_3/GPIO_4 samples to any SinCos encoder
+    float sincos_sample_s = (float)HAL_ADCEx_InjectedGetValue(hadc, ADC_INJECTED_RANK_2) / adc_full_scale;
+    float sincos_sample_c = (float)HAL_ADCEx_InjectedGetValue(hadc, ADC_INJECTED_RANK_3) / adc_full_scale;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        if (axes[i] && axes[i]->encoder_.config_.mode == Encoder::MODE_SINCOS) {
+            axes[i]->encoder_.sincos_sample_s_ = sincos_sample_s;
+            axes[i]->encoder_.sincos_sample_c_ = sincos_sample_c;
+        }
+    }
+
+    bool axes_ok = true;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        if (!axes[i] || axes[i]->error_)
+            axes_ok = false;
+    }
+    if (axes_ok) {
         if (oscilloscope_pos >= OSCILLOSCOPE_SIZE)
             oscilloscope_pos = 0;
         oscilloscope[oscilloscope_pos++] = vbus_voltage;
     }
 }
 
-static void decode_hall_samples(Encoder& enc, uint16_t GPIO_samples[num_GPIO]) {
+RAMFUNC static void decode_hall_samples(Encoder& enc, uint16_t GPIO_samples[num_GPIO]) {
     GPIO_TypeDef* hall_ports[] = {
         enc.hw_config_.hallC_port,
         enc.hw_config_.hallB_port,
@@ -464,7 +524,7 @@ static void decode_hall_samples(Encoder& enc, uint16_t GPIO_samples[num_GPIO]) {
 
 // This is the callback from the ADC that we expect after the PWM has triggered an ADC conversion.
 // TODO: Document how the phasing is done, link to timing diagram
-void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
+RAMFUNC void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
 #define calib_tau 0.2f  //@TOTO make more easily configurable
     static const float calib_filter_k = CURRENT_MEAS_PERIOD / calib_tau;
 
@@ -474,32 +534,29 @@ void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
         return;
     };
 
-    // Motor 0 is on Timer 1, which triggers ADC 2 and 3 on an injected conversion
-    // Motor 1 is on Timer 8, which triggers ADC 2 and 3 on a regular conversion
+    // Each motor timer triggers ADC 2 and 3 on one conversion group (see current_meas_triggers)
     // If the corresponding timer is counting up, we just sampled in SVM vector 0, i.e. real current
     // If we are counting down, we just sampled in SVM vector 7, with zero current
-    Axis& axis = injected ? *axes[0] : *axes[1];
-    int axis_num = injected ? 0 : 1;
-    Axis& other_axis = injected ? *axes[1] : *axes[0];
-    bool counting_down = axis.motor_.hw_config_.timer->Instance->CR1 & TIM_CR1_DIR;
+    const CurrentMeasTrigger_t* trigger = &current_meas_triggers[0];
+    while (trigger->injected != injected)
+        ++trigger;
+    bool counting_down = trigger->timer->Instance->CR1 & TIM_CR1_DIR;
     bool current_meas_not_DC_CAL = !counting_down;
+    size_t axis_num = trigger->axis;
+    Axis* axis = (axis_num < AXIS_COUNT) ? axes[axis_num] : nullptr;
 
     // Check the timing of the sequencing
-    if (current_meas_not_DC_CAL)
-        axis.motor_.log_timing(Motor::TIMING_LOG_ADC_CB_I);
-    else
-        axis.motor_.log_timing(Motor::TIMING_LOG_ADC_CB_DC);
-
-    bool update_timings = false;
-    if (hadc == &hadc2) {
-        if (&axis == axes[1] && counting_down)
-            update_timings = true; // update timings of M0
-        else if (&axis == axes[0] && !counting_down)
-            update_timings = true; // update timings of M1
+    if (axis) {
+        if (current_meas_not_DC_CAL)
+            axis->motor_.log_timing(Motor::TIMING_LOG_ADC_CB_I);
+        else
+            axis->motor_.log_timing(Motor::TIMING_LOG_ADC_CB_DC);
     }
 
     // Load next timings for the motor that we're not currently sampling
-    if (update_timings) {
+    if (hadc == &hadc2 && counting_down == trigger->next_timings_counting_down
+            && trigger->next_timings_axis < AXIS_COUNT) {
+        Axis& other_axis = *axes[trigger->next_timings_axis];
         if (!other_axis.motor_.next_timings_valid_) {
             // the motor control loop failed to update the timings in time
             // we must assume that it died and therefore float all phases
@@ -516,13 +573,17 @@ void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
         update_brake_current();
     }
 
+    // Without an axis, the conversion only serves to load the timings
+    if (!axis)
+        return;
+
     uint32_t ADCValue;
     if (injected) {
         ADCValue = HAL_ADCEx_InjectedGetValue(hadc, ADC_INJECTED_RANK_1);
     } else {
         ADCValue = HAL_ADC_GetValue(hadc);
     }
-    float current = axis.motor_.phase_current_from_adcval(ADCValue);
+    float current = axis->motor_.phase_current_from_adcval(ADCValue);
 
     if (current_meas_not_DC_CAL) {
         // ADC2 and ADC3 record the phB and phC currents concurrently,
@@ -533,22 +594,22 @@ void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
 
         // return or continue
         if (hadc == &hadc2) {
-            axis.motor_.current_meas_.phB = current - axis.motor_.DC_calib_.phB;
+            axis->motor_.current_meas_.phB = current - axis->motor_.DC_calib_.phB;
             return;
         } else {
-            axis.motor_.current_meas_.phC = current - axis.motor_.DC_calib_.phC;
+            axis->motor_.current_meas_.phC = current - axis->motor_.DC_calib_.phC;
         }
         // Prepare hall readings
         // TODO move this to inside encoder update function
-        decode_hall_samples(axis.encoder_, GPIO_port_samples[axis_num]);
+        decode_hall_samples(axis->encoder_, GPIO_port_samples[axis_num]);
         // Trigger axis thread
-        axis.signal_current_meas();
+        axis->signal_current_meas();
     } else {
         // DC_CAL measurement
         if (hadc == &hadc2) {
-            axis.motor_.DC_calib_.phB += (current - axis.motor_.DC_calib_.phB) * calib_filter_k;
+            axis->motor_.DC_calib_.phB += (current - axis->motor_.DC_calib_.phB) * calib_filter_k;
         } else {
-            axis.motor_.DC_calib_.phC += (current - axis.motor_.DC_calib_.phC) * calib_filter_k;
+            axis->motor_.DC_calib_.phC += (current - axis->motor_.DC_calib_.phC) * calib_filter_k;
         }
     }
 }
@@ -561,20 +622,17 @@ void tim_update_cb(TIM_HandleTypeDef* htim) {
     if (counting_down)
         return;
     
-    int sample_ch;
-    Axis* axis;
-    if (htim == &htim1) {
-        sample_ch = 0;
-        axis = axes[0];
-    } else if (htim == &htim8) {
-        sample_ch = 1;
-        axis = axes[1];
-    } else {
+    size_t sample_ch = AXIS_COUNT;
+    for (size_t i = 0; i < CURRENT_MEAS_TRIGGER_COUNT; ++i) {
+        if (htim == current_meas_triggers[i].timer)
+            sample_ch = current_meas_triggers[i].axis;
+    }
+    if (sample_ch >= AXIS_COUNT) {
         low_level_fault(Motor::ERROR_UNEXPECTED_TIMER_CALLBACK);
         return;
     }
 
-    axis->encoder_.sample_now();
+    axes[sample_ch]->encoder_.sample_now();
 
     for (int i = 0; i < num_GPIO; ++i) {
         GPIO_port_samples[sample_ch][i] = GPIOs_to_samp[i]->IDR;
@@ -680,6 +738,62 @@ void pwm_in_init() {
     }
 }
 
+// @brief Starts counting the rising edges of a step input in hardware.
+// TIM9 is clocked by the step signal (external clock mode 1), so the steps
+// don't cause an interrupt each. It is the only free timer with inputs on the
+// GPIO header: GPIO3 is TIM9_CH1 and GPIO4 is TIM9_CH2.
+// @returns false if the pin has no timer input or the counter is already in use
+bool step_counter_start(uint16_t gpio_num) {
+    uint32_t trigger;
+    if (gpio_num == 3) {
+        trigger = TIM_TS_TI1FP1;
+    } else if (gpio_num == 4) {
+        trigger = TIM_TS_TI2FP2;
+    } else {
+        return false;
+    }
+    if (htim_step_counter.Instance)
+        return false;
+
+    __HAL_RCC_TIM9_CLK_ENABLE();
+
+    GPIO_InitTypeDef GPIO_InitStruct;
+    GPIO_InitStruct.Pin = get_gpio_pin_by_pin(gpio_num);
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+    GPIO_InitStruct.Alternate = GPIO_AF3_TIM9;
+    HAL_GPIO_DeInit(get_gpio_port_by_pin(gpio_num), get_gpio_pin_by_pin(gpio_num));
+    HAL_GPIO_Init(get_gpio_port_by_pin(gpio_num), &GPIO_InitStruct);
+
+    htim_step_counter.Instance = TIM9;
+    htim_step_counter.Init.Prescaler = 0;
+    htim_step_counter.Init.CounterMode = TIM_COUNTERMODE_UP;
+    htim_step_counter.Init.Period = 0xffff;
+    htim_step_counter.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+    HAL_TIM_Base_Init(&htim_step_counter);
+
+    TIM_SlaveConfigTypeDef sSlaveConfig;
+    sSlaveConfig.SlaveMode = TIM_SLAVEMODE_EXTERNAL1;
+    sSlaveConfig.InputTrigger = trigger;
+    sSlaveConfig.TriggerPolarity = TIM_TRIGGERPOLARITY_RISING;
+    sSlaveConfig.TriggerPrescaler = TIM_TRIGGERPRESCALER_DIV1;
+    sSlaveConfig.TriggerFilter = 3; // 8 samples at 168MHz, passes step rates of several MHz
+    HAL_TIM_SlaveConfigSynchronization(&htim_step_counter, &sSlaveConfig);
+
+    __HAL_TIM_SET_COUNTER(&htim_step_counter, 0);
+    HAL_TIM_Base_Start(&htim_step_counter);
+    return true;
+}
+
+void step_counter_stop() {
+    if (htim_step_counter.Instance) {
+        HAL_TIM_Base_Stop(&htim_step_counter);
+        HAL_TIM_Base_DeInit(&htim_step_counter);
+        htim_step_counter.Instance = nullptr;
+    }
+}
+
 //TODO: These expressions have integer division by 1MHz, so it will be incorrect for clock speeds of not-integer MHz
 #define TIM_2_5_CLOCK_HZ        TIM_APB1_CLOCK_HZ
 #define PWM_MIN_HIGH_TIME          ((TIM_2_5_CLOCK_HZ / 1000000UL) * 1000UL) // 1ms high is considered full reverse
@@ -753,6 +867,9 @@ static void analog_polling_thread(void *)
 
 void start_analog_thread()
 {
-    osThreadDef(thread_def, analog_polling_thread, osPriorityLow, 0, 4*512);
+    static const size_t stack_size = 4*512; // [words]
+    static uint32_t stack[stack_size]; // core coupled memory is full
+    static osStaticThreadDef_t control_block;
+    osThreadStaticDef(thread_def, analog_polling_thread, osPriorityLow, 0, stack_size, stack, &control_block);
     osThreadCreate(osThread(thread_def), NULL);
 }
@@ -27,7 +27,7 @@ extern uint16_t adc_measurements_[ADC_CHANNEL_COUNT];
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions --------------------------------------------------------*/
 
-void safety_critical_arm_motor_pwm(Motor& motor);
+bool safety_critical_arm_motor_pwm(Motor& motor);
 bool safety_critical_disarm_motor_pwm(Motor& motor);
 void safety_critical_apply_motor_pwm_timings(Motor& motor, uint16_t timings[3]);
 void safety_critical_arm_brake_resistor();
@@ -51,6 +51,9 @@ void sync_timers(TIM_HandleTypeDef* htim_a, TIM_HandleTypeDef* htim_b,
 void start_general_purpose_adc();
 float get_adc_voltage(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin);
 void pwm_in_init();
+bool step_counter_start(uint16_t gpio_num);
+void step_counter_stop();
+inline uint16_t step_counter_read() { return TIM9->CNT; }
 void start_analog_thread();
 
 void update_brake_current();
@@ -21,6 +21,28 @@ SystemStats_t system_stats_ = { 0 };
 
 Axis *axes[AXIS_COUNT];
 
+// Storage of the axis objects. They are constructed in odrive_main once the
+// configuration is loaded, but don't use the heap.
+// Core coupled memory holds the thread stacks, which used to live in the
+// FreeRTOS heap there. Axis includes the control loop stack, so it goes to
+// core coupled memory. The other objects live in the main RAM, where they
+// used to be allocated from the newlib heap. Both regions are checked by the
+// linker. Core coupled memory is not initialized by the startup code, which
+// is fine for placement new.
+template<typename T>
+using ObjectStorage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+static ObjectStorage<Encoder> encoder_storage[AXIS_COUNT];
+static ObjectStorage<SensorlessEstimator> sensorless_estimator_storage[AXIS_COUNT];
+static ObjectStorage<Controller> controller_storage[AXIS_COUNT];
+static ObjectStorage<Motor> motor_storage[AXIS_COUNT];
+static ObjectStorage<TrapezoidalTrajectory> trap_storage[AXIS_COUNT];
+__attribute__((section(".ccmram")))
+static ObjectStorage<Axis> axis_storage[AXIS_COUNT];
+
+// Anticogging maps, zeroed by the startup code. At 32kB per axis they are
+// the largest objects in the main RAM.
+static float cogging_maps[AXIS_COUNT][Controller::ANTICOGGING_MAX_CPR];
+
 typedef Config<
     BoardConfig_t,
     Encoder::Config_t[AXIS_COUNT],
@@ -30,19 +52,48 @@ typedef Config<
     TrapezoidalTrajectory::Config_t[AXIS_COUNT],
     Axis::Config_t[AXIS_COUNT]> ConfigFormat;
 
-void save_configuration(void) {
-    if (ConfigFormat::safe_store_config(
-            &board_config,
-            &encoder_configs,
-            &sensorless_configs,
-            &controller_configs,
-            &motor_configs,
-            &trap_configs,
-            &axis_configs)) {
-        //printf("saving configuration failed\r\n"); osDelay(5);
-    } else {
-        user_config_loaded_ = true;
+// Copy of the configuration that is handed to the NVM thread, so that the
+// live configuration can keep changing while it is being written.
+static struct {
+    BoardConfig_t board;
+    Encoder::Config_t encoder[AXIS_COUNT];
+    SensorlessEstimator::Config_t sensorless[AXIS_COUNT];
+    Controller::Config_t controller[AXIS_COUNT];
+    Motor::Config_t motor[AXIS_COUNT];
+    TrapezoidalTrajectory::Config_t trap[AXIS_COUNT];
+    Axis::Config_t axis[AXIS_COUNT];
+} config_snapshot_;
+
+volatile bool config_save_pending_ = false;
+volatile bool config_save_deferred_ = false; // a pending save or erase waits for the motors to be disarmed
+static volatile bool config_erase_pending_ = false;
+static volatile bool nvm_flush_requested_ = false;
+volatile bool nvm_erase_in_progress_ = false; // arming is refused while set
+static osThreadId nvm_thread;
+
+// @brief Queues a save of the current configuration.
+// The flash is written by the NVM thread in the background, so this returns
+// immediately. config_save_pending_ is cleared once the data is committed.
+// If the save needs a sector erase while a motor is armed, it is deferred
+// until all motors are disarmed and config_save_deferred_ is set meanwhile.
+// @returns false if another NVM operation is still pending
+bool save_configuration(void) {
+    if (config_save_pending_ || config_erase_pending_)
+        return false;
+
+    config_snapshot_.board = board_config;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        config_snapshot_.encoder[i] = encoder_configs[i];
+        config_snapshot_.sensorless[i] = sensorless_configs[i];
+        config_snapshot_.controller[i] = controller_configs[i];
+        config_snapshot_.motor[i] = motor_configs[i];
+        config_snapshot_.trap[i] = trap_configs[i];
+        config_snapshot_.axis[i] = axis_configs[i];
     }
+
+    config_save_pending_ = true;
+    xTaskNotifyGive(nvm_thread);
+    return true;
 }
 
 extern "C" int load_configuration(void) {
@@ -74,8 +125,114 @@ extern "C" int load_configuration(void) {
     return user_config_loaded_;
 }
 
-void erase_configuration(void) {
-    NVM_erase();
+// @brief Queues an erase of the stored configuration.
+// @returns false if another NVM operation is still pending
+bool erase_configuration(void) {
+    if (config_save_pending_ || config_erase_pending_)
+        return false;
+    config_erase_pending_ = true;
+    xTaskNotifyGive(nvm_thread);
+    return true;
+}
+
+// @brief Completes pending NVM operations and resets the microcontroller.
+void reboot(void) {
+    nvm_flush_requested_ = true;
+    xTaskNotifyGive(nvm_thread);
+    while (config_save_pending_ || config_erase_pending_)
+        osDelay(1);
+    NVIC_SystemReset();
+}
+
+// @brief Starts a section in which the NVM thread may erase a flash sector.
+// An erase stalls all code that executes from flash, including the control
+// loops, for up to a few seconds. Therefore it is deferred until all motors
+// are disarmed. When a reboot is pending the motors are disarmed right away.
+// The check and nvm_erase_in_progress_ are set atomically, so no axis can
+// arm between the check and the erase. End the section with nvm_end_erase().
+// @returns false if a motor is armed and the erase must be deferred
+static bool nvm_begin_erase() {
+    bool allowed = true;
+    uint32_t prim = cpu_enter_critical();
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        if (axes[i]->motor_.armed_state_ != Motor::ARMED_STATE_DISARMED) {
+            if (!nvm_flush_requested_) {
+                allowed = false;
+                break;
+            }
+            safety_critical_disarm_motor_pwm(axes[i]->motor_);
+        }
+    }
+    if (allowed)
+        nvm_erase_in_progress_ = true;
+    cpu_exit_critical(prim);
+    return allowed;
+}
+
+static void nvm_end_erase() {
+    nvm_erase_in_progress_ = false;
+}
+
+// The NVM thread runs at low priority. Programming stalls flash fetches for
+// one word at a time, which delays the control interrupt (it executes from
+// flash) by a few microseconds per word. Saves without an erase therefore
+// run while the motors are armed. Saves that need a sector erase, and all
+// erase requests, only run while all motors are disarmed; until then they
+// are retried.
+static void nvm_thread_fn(void *) {
+    const size_t config_size = ConfigFormat::get_safe_store_size();
+    for (;;) {
+        // wake up periodically to retry deferred requests
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+
+        if (config_save_pending_) {
+            bool erase = NVM_write_requires_erase(config_size);
+            if (erase && !nvm_begin_erase()) {
+                config_save_deferred_ = true;
+                continue;
+            }
+            int result = ConfigFormat::safe_store_config(
+                    &config_snapshot_.board,
+                    &config_snapshot_.encoder,
+                    &config_snapshot_.sensorless,
+                    &config_snapshot_.controller,
+                    &config_snapshot_.motor,
+                    &config_snapshot_.trap,
+                    &config_snapshot_.axis);
+            if (erase)
+                nvm_end_erase();
+            if (result) {
+                //printf("saving configuration failed\r\n"); osDelay(5);
+            } else {
+                user_config_loaded_ = true;
+                // Erase the next write sector now if it's full, so that a
+                // save while the motors are running doesn't have to wait.
+                if (!nvm_flush_requested_ && nvm_begin_erase()) {
+                    NVM_prepare_write(config_size);
+                    nvm_end_erase();
+                }
+            }
+            config_save_deferred_ = false;
+            config_save_pending_ = false;
+        } else if (config_erase_pending_) {
+            if (!nvm_begin_erase()) {
+                config_save_deferred_ = true;
+                continue;
+            }
+            NVM_erase();
+            nvm_end_erase();
+            config_save_deferred_ = false;
+            config_erase_pending_ = false;
+        }
+    }
+}
+
+static void start_nvm_thread() {
+    static const size_t stack_size = 512; // [words]
+    static uint32_t stack[stack_size]; // core coupled memory is full
+    static osStaticThreadDef_t control_block;
+    osThreadStaticDef(nvm_thread_def, nvm_thread_fn, osPriorityLow, 0, stack_size, stack, &control_block);
+    nvm_thread = osThreadCreate(osThread(nvm_thread_def), NULL);
 }
 
 void enter_dfu_mode() {
@@ -106,12 +263,14 @@ void vApplicationIdleHook(void) {
         system_stats_.uptime = xTaskGetTickCount();
         system_stats_.min_heap_space = xPortGetMinimumEverFreeHeapSize();
         system_stats_.min_stack_space_comms = uxTaskGetStackHighWaterMark(comm_thread) * sizeof(StackType_t);
-        system_stats_.min_stack_space_axis0 = uxTaskGetStackHighWaterMark(axes[0]->thread_id_) * sizeof(StackType_t);
-        system_stats_.min_stack_space_axis1 = uxTaskGetStackHighWaterMark(axes[1]->thread_id_) * sizeof(StackType_t);
+        for (size_t i = 0; i < AXIS_COUNT; ++i) {
+            system_stats_.min_stack_space_axis[i] = uxTaskGetStackHighWaterMark(axes[i]->thread_id_) * sizeof(StackType_t);
+        }
         system_stats_.min_stack_space_usb = uxTaskGetStackHighWaterMark(usb_thread) * sizeof(StackType_t);
         system_stats_.min_stack_space_uart = uxTaskGetStackHighWaterMark(uart_thread) * sizeof(StackType_t);
         system_stats_.min_stack_space_usb_irq = uxTaskGetStackHighWaterMark(usb_irq_thread) * sizeof(StackType_t);
         system_stats_.min_stack_space_startup = uxTaskGetStackHighWaterMark(defaultTaskHandle) * sizeof(StackType_t);
+        system_stats_.min_stack_space_nvm = uxTaskGetStackHighWaterMark(nvm_thread) * sizeof(StackType_t);
     }
 }
 }
@@ -161,15 +320,16 @@ int odrive_main(void) {
 
     // Construct all objects.
     for (size_t i = 0; i < AXIS_COUNT; ++i) {
-        Encoder *encoder = new Encoder(hw_configs[i].encoder_config,
+        Encoder *encoder = new (&encoder_storage[i]) Encoder(hw_configs[i].encoder_config,
                                        encoder_configs[i]);
-        SensorlessEstimator *sensorless_estimator = new SensorlessEstimator(sensorless_configs[i]);
-        Controller *controller = new Controller(controller_configs[i]);
-        Motor *motor = new Motor(hw_configs[i].motor_config,
+        SensorlessEstimator *sensorless_estimator = new (&sensorless_estimator_storage[i]) SensorlessEstimator(sensorless_configs[i]);
+        Controller *controller = new (&controller_storage[i]) Controller(controller_configs[i]);
+        controller->anticogging_.cogging_map = cogging_maps[i];
+        Motor *motor = new (&motor_storage[i]) Motor(hw_configs[i].motor_config,
                                  hw_configs[i].gate_driver_config,
                                  motor_configs[i]);
-        TrapezoidalTrajectory *trap = new TrapezoidalTrajectory(trap_configs[i]);
-        axes[i] = new Axis(hw_configs[i].axis_config, axis_configs[i],
+        TrapezoidalTrajectory *trap = new (&trap_storage[i]) TrapezoidalTrajectory(trap_configs[i]);
+        axes[i] = new (&axis_storage[i]) Axis(hw_configs[i].axis_config, axis_configs[i],
                 *encoder, *sensorless_estimator, *controller, *motor, *trap);
     }
     
@@ -208,12 +368,12 @@ int odrive_main(void) {
 
     // Start state machine threads. Each thread will go through various calibration
     // procedures and then run the actual controller loops.
-    // TODO: generalize for AXIS_COUNT != 2
     for (size_t i = 0; i < AXIS_COUNT; ++i) {
         axes[i]->start_thread();
     }
 
     start_analog_thread();
+    start_nvm_thread();
 
     system_stats_.fully_booted = true;
     return 0;
@@ -40,10 +40,12 @@ bool Motor::arm() {
 
     // Wait until the interrupt handler triggers twice. This gives
     // the control loop the correct time quota to set up modulation timings.
-    if (!axis_->wait_for_current_meas())
-        return axis_->error_ |= Axis::ERROR_CURRENT_MEASUREMENT_TIMEOUT, false;
-    next_timings_valid_ = false;
-    safety_critical_arm_motor_pwm(*this);
+    // Arming is refused for the duration of a flash erase, so retry then.
+    do {
+        if (!axis_->wait_for_current_meas())
+            return axis_->error_ |= Axis::ERROR_CURRENT_MEASUREMENT_TIMEOUT, false;
+        next_timings_valid_ = false;
+    } while (!safety_critical_arm_motor_pwm(*this));
     return true;
 }
 
@@ -301,7 +303,7 @@ bool Motor::run_calibration() {
     return true;
 }
 
-bool Motor::enqueue_modulation_timings(float mod_alpha, float mod_beta) {
+RAMFUNC bool Motor::enqueue_modulation_timings(float mod_alpha, float mod_beta) {
     float tA, tB, tC;
     if (SVM(mod_alpha, mod_beta, &tA, &tB, &tC) != 0)
         return set_error(ERROR_MODULATION_MAGNITUDE), false;
@@ -323,7 +325,7 @@ bool Motor::enqueue_voltage_timings(float v_alpha, float v_beta) {
 }
 
 // We should probably make FOC Current call FOC Voltage to avoid duplication.
-bool Motor::FOC_voltage(float v_d, float v_q, float pwm_phase) {
+RAMFUNC bool Motor::FOC_voltage(float v_d, float v_q, float pwm_phase) {
     float c = our_arm_cos_f32(pwm_phase);
     float s = our_arm_sin_f32(pwm_phase);
     float v_alpha = c*v_d - s*v_q;
@@ -331,7 +333,7 @@ bool Motor::FOC_voltage(float v_d, float v_q, float pwm_phase) {
     return enqueue_voltage_timings(v_alpha, v_beta);
 }
 
-bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_phase) {
+RAMFUNC bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_phase) {
     // Syntactic sugar
     CurrentControl_t& ictrl = current_control_;
 
@@ -406,7 +408,7 @@ bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_pha
 }
 
 
-bool Motor::update(float current_setpoint, float phase, float phase_vel) {
+RAMFUNC bool Motor::update(float current_setpoint, float phase, float phase_vel) {
     current_setpoint *= config_.direction;
     phase *= config_.direction;
     phase_vel *= config_.direction;
@@ -370,6 +370,44 @@ int NVM_commit(void) {
     return status;
 }
 
+// @brief Checks if a write transaction of the given length would erase a sector.
+//
+// An erase stalls all code that executes from flash (which is most of the
+// firmware) for up to a few seconds, while programming only stalls it for
+// the duration of a single word. Callers use this to defer a transaction
+// until such a stall is acceptable.
+//
+// @param length: Length of the staging block (as passed to NVM_start_write)
+// @returns 1 if NVM_start_write or the subsequent NVM_commit erases a sector, 0 otherwise
+int NVM_write_requires_erase(size_t length) {
+    sector_t *read_sector = &sectors[read_sector_];
+    sector_t *target = &sectors[1 - read_sector_];
+
+    length = (length + 7) >> 3; // round to multiple of 64 bit
+    if (length > target->n_data - target->index)
+        return 1;
+    if (read_sector->index >= read_sector->n_data)
+        return 1;
+    return 0;
+}
+
+// @brief Erases the write sector ahead of time if it has no room left for a
+// write transaction of the given length.
+//
+// Call this at a point where a long stall is acceptable so that the next
+// transaction does not have to erase.
+//
+// @param length: Length of the next staging block
+// @returns 0 on success or a non-zero error code otherwise
+int NVM_prepare_write(size_t length) {
+    sector_t *target = &sectors[1 - read_sector_];
+
+    length = (length + 7) >> 3; // round to multiple of 64 bit
+    if (length > target->n_data - target->index)
+        return erase(target);
+    return 0;
+}
+
 
 #include <cmsis_os.h>
 /** @brief Call this at startup to test/demo the NVM driver
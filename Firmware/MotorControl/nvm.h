@@ -24,6 +24,8 @@ int NVM_read(size_t offset, uint8_t *data, size_t length);
 int NVM_start_write(size_t length);
 int NVM_write(size_t offset, uint8_t *data, size_t length);
 int NVM_commit(void);
+int NVM_write_requires_erase(size_t length);
+int NVM_prepare_write(size_t length);
 void NVM_demo(void);
 
 #ifdef __cplusplus
@@ -115,6 +115,11 @@ struct Config<T, Ts...> {
         return 0;
     }
 
+    // @brief Returns the number of bytes that safe_store_config() writes to the NVM.
+    static size_t get_safe_store_size() {
+        return Config<T, Ts...>::get_size() + 2;
+    }
+
     // @brief Stores one or more consecutive objects to the NVM. In addition to the
     // provided objects, a CRC of the data is stored.
     //
@@ -123,7 +128,7 @@ struct Config<T, Ts...> {
     // config data length changes, the CRC validation will fail even if the developer
     // forgets to update the config version number.
     static int safe_store_config(const T* val0, const Ts* ... vals) {
-        size_t size = Config<T, Ts...>::get_size() + 2;
+        size_t size = get_safe_store_size();
         //printf("config is %d bytes\r\n", size); osDelay(5);
         if (size > NVM_get_max_write_length())
             return -1;
@@ -0,0 +1,37 @@
+
+#include "odrive_main.h"
+
+// @brief Places all observer poles at -bandwidth.
+// Returns false if the gains are too high for the discrete time approximation.
+bool Observer::set_bandwidth(Type_t type, float bandwidth) {
+    if (type == TYPE_PVA) {
+        pos_gain_ = current_meas_period * 3.0f * bandwidth;
+        vel_gain_ = current_meas_period * 3.0f * bandwidth * bandwidth;
+        accel_gain_ = current_meas_period * bandwidth * bandwidth * bandwidth;
+    } else {
+        pos_gain_ = current_meas_period * 2.0f * bandwidth;
+        vel_gain_ = current_meas_period * bandwidth * bandwidth;
+        accel_gain_ = 0.0f;
+        accel_estimate_ = 0.0f;
+    }
+    return pos_gain_ < 1.0f;
+}
+
+// @brief Advances the observer by one control period.
+// @param accel_input: known acceleration, e.g. from the commanded torque
+// Returns the predicted position increment.
+RAMFUNC float Observer::predict(float accel_input) {
+    float accel = accel_estimate_ + accel_input;
+    float delta_pos = current_meas_period * (vel_estimate_ + 0.5f * current_meas_period * accel);
+    vel_estimate_ += current_meas_period * accel;
+    return delta_pos;
+}
+
+// @brief Corrects the velocity and acceleration states with the measured
+// position error (measured - predicted).
+// Returns the position correction.
+RAMFUNC float Observer::correct(float pos_err) {
+    vel_estimate_ += vel_gain_ * pos_err;
+    accel_estimate_ += accel_gain_ * pos_err;
+    return pos_gain_ * pos_err;
+}
@@ -0,0 +1,34 @@
+#ifndef __OBSERVER_HPP
+#define __OBSERVER_HPP
+
+#ifndef __ODRIVE_MAIN_H
+#error "This file should not be included directly. Include odrive_main.h instead."
+#endif
+
+// Position/velocity/acceleration tracking observer shared by the encoder and
+// the sensorless estimator.
+// The position state is kept by the user of this class, because the users
+// track positions with different wrap-around (linear count, count in cpr,
+// electrical phase). predict() and correct() return the position increments
+// to apply to each of them.
+class Observer {
+public:
+    enum Type_t {
+        TYPE_PLL = 0, // 2nd order: position and velocity (critically damped PLL)
+        TYPE_PVA = 1, // 3rd order: position, velocity and acceleration
+    };
+
+    bool set_bandwidth(Type_t type, float bandwidth);
+    float predict(float accel_input);
+    float correct(float pos_err);
+    float pos_correction(float pos_err) const { return pos_gain_ * pos_err; }
+
+    float vel_estimate_ = 0.0f;   // [unit/s]
+    float accel_estimate_ = 0.0f; // [unit/s^2]
+    // Discrete time observer gains, i.e. already multiplied by current_meas_period
+    float pos_gain_ = 0.0f;   // [unit / unit]
+    float vel_gain_ = 0.0f;   // [(unit/s) / unit]
+    float accel_gain_ = 0.0f; // [(unit/s^2) / unit]
+};
+
+#endif // __OBSERVER_HPP
@@ -39,6 +39,9 @@ static const int current_meas_hz = CURRENT_MEAS_HZ;
 // extern const float elec_rad_per_enc;
 extern uint32_t _reboot_cookie;
 extern bool user_config_loaded_;
+extern volatile bool config_save_pending_;
+extern volatile bool config_save_deferred_;
+extern volatile bool nvm_erase_in_progress_;
 
 extern uint64_t serial_number;
 extern char serial_number_str[13];
@@ -47,13 +50,13 @@ typedef struct {
     bool fully_booted;
     uint32_t uptime; // [ms]
     uint32_t min_heap_space; // FreeRTOS heap [Bytes]
-    uint32_t min_stack_space_axis0; // minimum remaining space since startup [Bytes]
-    uint32_t min_stack_space_axis1;
+    uint32_t min_stack_space_axis[HW_AXIS_COUNT]; // minimum remaining space since startup [Bytes]
     uint32_t min_stack_space_comms;
     uint32_t min_stack_space_usb;
     uint32_t min_stack_space_uart;
     uint32_t min_stack_space_usb_irq;
     uint32_t min_stack_space_startup;
+    uint32_t min_stack_space_nvm;
 } SystemStats_t;
 extern SystemStats_t system_stats_;
 
@@ -90,7 +93,7 @@ extern bool user_config_loaded_;
 class Axis;
 class Motor;
 
-constexpr size_t AXIS_COUNT = 2;
+constexpr size_t AXIS_COUNT = HW_AXIS_COUNT;
 extern Axis *axes[AXIS_COUNT];
 
 // if you use the oscilloscope feature you can bump up this value
@@ -113,11 +116,15 @@ inline ENUMTYPE operator ~ (ENUMTYPE a) { return static_cast<ENUMTYPE>(~static_c
 // ODrive specific includes
 #include <utils.h>
 #include <low_level.h>
+#include <observer.hpp>
 #include <encoder.hpp>
 #include <sensorless_estimator.hpp>
+#include <input_shaper.hpp>
+#include <biquad.hpp>
 #include <controller.hpp>
 #include <motor.hpp>
 #include <trapTraj.hpp>
+#include <sCurveTraj.hpp>
 #include <axis.hpp>
 #include <communication/communication.h>
 
@@ -125,8 +132,9 @@ inline ENUMTYPE operator ~ (ENUMTYPE a) { return static_cast<ENUMTYPE>(~static_c
 
 
 // general system functions defined in main.cpp
-void save_configuration(void);
-void erase_configuration(void);
+bool save_configuration(void);
+bool erase_configuration(void);
+void reboot(void);
 void enter_dfu_mode(void);
 
 #endif /* __ODRIVE_MAIN_H */
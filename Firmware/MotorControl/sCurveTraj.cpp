@@ -0,0 +1,156 @@
+#include <math.h>
+#include "odrive_main.h"
+#include "utils.h"
+
+// Symbol                     Description
+// Xi, Vi and Ai              Initial conditions
+// Xf                         Position set-point (final velocity and acceleration are 0)
+// s                          Direction (sign) of the trajectory
+// Vmax, Amax, Dmax and Jmax  Kinematic bounds
+// Vr                         Reached (cruise) velocity
+// Ap                         Peak acceleration of a velocity transition
+
+// Advance the state (X, V, A) by T seconds of constant jerk J
+static void integrate(float T, float J, float* X, float* V, float* A) {
+    *X += T * (*V + T * (0.5f * *A + T * J * (1.0f / 6.0f)));
+    *V += T * (*A + 0.5f * T * J);
+    *A += T * J;
+}
+
+// Plans the three segments (jerk, constant accel, jerk) that take the
+// velocity from V0 with acceleration A0 to V1 with zero acceleration.
+static void plan_transition(SCurveTrajectory::Segment_t* seg, float V0, float A0, float V1,
+                            float Amax, float Jmax) {
+    // Velocity change caused by just ramping A0 down to zero decides the direction
+    float dV_ramp = 0.5f * A0 * fabsf(A0) / Jmax;
+    float dir = sign_hard(V1 - V0 - dV_ramp);
+
+    // Mirror the problem so that we accelerate in positive direction
+    float dV = dir * (V1 - V0);
+    float A0n = dir * A0;
+    float Ap = Amax;
+    float T1 = fabsf(Ap - A0n) / Jmax;
+    float T3 = Ap / Jmax;
+    float T2 = (dV - 0.5f * (A0n + Ap) * T1 - 0.5f * Ap * T3) / Ap;
+    if (T2 < 0.0f) {
+        // Amax is not reached (triangular acceleration profile)
+        T2 = 0.0f;
+        if (A0n <= Amax) {
+            Ap = sqrtf(std::max(0.0f, Jmax * dV + 0.5f * SQ(A0n)));
+            T1 = (Ap - A0n) / Jmax;
+            T3 = Ap / Jmax;
+        }
+    }
+
+    seg[0].T = T1;
+    seg[0].J = (Ap >= A0n) ? dir * Jmax : -dir * Jmax;
+    seg[1].T = T2;
+    seg[1].J = 0.0f;
+    seg[2].T = T3;
+    seg[2].J = -dir * Jmax;
+}
+
+// Displacement covered by n segments starting at velocity V and acceleration A
+static float displacement(const SCurveTrajectory::Segment_t* seg, size_t n, float V, float A) {
+    float X = 0.0f;
+    for (size_t i = 0; i < n; ++i)
+        integrate(seg[i].T, seg[i].J, &X, &V, &A);
+    return X;
+}
+
+bool SCurveTrajectory::planSCurve(float Xf, float Xi, float Vi, float Ai,
+                                  float Vmax, float Amax, float Dmax, float Jmax) {
+    if (!(Vmax > 0.0f && Amax > 0.0f && Dmax > 0.0f && Jmax > 0.0f))
+        return false;
+
+    Segment_t* accel = &segments_[0];
+    Segment_t* cruise = &segments_[3];
+    Segment_t* decel = &segments_[4];
+
+    // Displacement of a move that reaches cruise velocity Vr
+    auto move_displacement = [&](float Vr) {
+        plan_transition(accel, Vi, Ai, Vr, Amax, Jmax);
+        plan_transition(decel, Vr, 0.0f, 0.0f, Dmax, Jmax);
+        return displacement(accel, 3, Vi, Ai) + displacement(decel, 3, Vr, 0.0f);
+    };
+
+    float dX = Xf - Xi; // Distance to travel
+    float dXstop = move_displacement(0.0f); // Minimum stopping displacement
+    float s = sign_hard(dX - dXstop); // Sign of coast velocity (if any)
+
+    float Vr = s * Vmax;
+    float dXmin = move_displacement(Vr);
+
+    // Are we displacing enough to reach cruising speed?
+    if (s*dX < s*dXmin) {
+        // Short move: find the highest cruise velocity that doesn't overshoot.
+        // The displacement grows monotonically with s*Vr in [0, Vmax].
+        float Vlo = 0.0f;
+        float Vhi = Vr;
+        for (int i = 0; i < 32; ++i) {
+            float Vmid = 0.5f * (Vlo + Vhi);
+            if (s * move_displacement(Vmid) < s * dX)
+                Vlo = Vmid;
+            else
+                Vhi = Vmid;
+        }
+        Vr = Vlo;
+        dXmin = move_displacement(Vr);
+    }
+
+    // Cruise for the remaining distance
+    cruise->T = (Vr != 0.0f) ? std::max(0.0f, (dX - dXmin) / Vr) : 0.0f;
+    cruise->J = 0.0f;
+
+    // Fill in the start states used at evaluation-time
+    float X = Xi, V = Vi, A = Ai;
+    Tf_ = 0.0f;
+    for (Segment_t& seg : segments_) {
+        seg.X0 = X;
+        seg.V0 = V;
+        seg.A0 = A;
+        seg.start_tick = traj_ticks(Tf_);
+        seg.t0 = (float)seg.start_tick * current_meas_period - Tf_;
+        integrate(seg.T, seg.J, &X, &V, &A);
+        Tf_ += seg.T;
+    }
+    Xf_ = Xf;
+    end_tick_ = traj_ticks(Tf_);
+    segment_idx_ = 0;
+
+    return true;
+}
+
+// @brief Evaluates the trajectory at the given control loop tick.
+// Like TrapezoidalTrajectory::eval, the current segment is only changed at
+// segment boundaries and the time is relative to the segment start.
+SCurveTrajectory::Step_t SCurveTrajectory::eval(uint32_t tick) {
+    Step_t trajStep;
+    if (tick >= end_tick_) {  // Final Condition
+        trajStep.Y   = Xf_;
+        trajStep.Yd  = 0.0f;
+        trajStep.Ydd = 0.0f;
+        return trajStep;
+    }
+
+    // A tick before the current segment means the trajectory was replanned
+    if (tick < segments_[segment_idx_].start_tick)
+        segment_idx_ = 0;
+    while (segment_idx_ + 1 < sizeof(segments_) / sizeof(segments_[0]) &&
+           tick >= segments_[segment_idx_ + 1].start_tick)
+        ++segment_idx_;
+
+    const Segment_t& seg = segments_[segment_idx_];
+    const uint32_t split = TrapezoidalTrajectory::SPLIT_TICKS_LOG2;
+    uint32_t ticks = tick - seg.start_tick;
+    float X = seg.X0, V = seg.V0, A = seg.A0;
+    if (ticks >> split) {
+        integrate((float)(ticks >> split) * ((float)(1u << split) * current_meas_period), seg.J, &X, &V, &A);
+        ticks &= (1u << split) - 1;
+    }
+    integrate((float)ticks * current_meas_period + seg.t0, seg.J, &X, &V, &A);
+    trajStep.Y   = X;
+    trajStep.Yd  = V;
+    trajStep.Ydd = A;
+    return trajStep;
+}
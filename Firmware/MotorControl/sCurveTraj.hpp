@@ -0,0 +1,35 @@
+#ifndef _S_CURVE_TRAJ_H
+#define _S_CURVE_TRAJ_H
+
+// Jerk limited (7-segment) counterpart of TrapezoidalTrajectory.
+// It uses the limits in the TrapezoidalTrajectory config and is selected
+// by setting a non-zero jerk_limit there.
+class SCurveTrajectory {
+public:
+    typedef TrapezoidalTrajectory::Step_t Step_t;
+
+    // Segment of constant jerk, with the state at its start
+    struct Segment_t {
+        float T;   // [s] duration
+        float J;   // [count/s^3]
+        float X0;  // [count]
+        float V0;  // [count/s]
+        float A0;  // [count/s^2]
+        uint32_t start_tick; // first control loop tick in this segment
+        float t0;  // [s] time between the segment start and start_tick
+    };
+
+    bool planSCurve(float Xf, float Xi, float Vi, float Ai,
+                    float Vmax, float Amax, float Dmax, float Jmax);
+    Step_t eval(uint32_t tick);
+
+    // accel transition (3), cruise (1), decel transition (3)
+    Segment_t segments_[7];
+
+    float Xf_ = 0.0f;
+    float Tf_ = 0.0f;
+    size_t segment_idx_ = 0;
+    uint32_t end_tick_ = 0;
+};
+
+#endif
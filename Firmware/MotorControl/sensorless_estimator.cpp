@@ -56,26 +56,23 @@ bool SensorlessEstimator::update() {
     V_alpha_beta_memory_[0] = axis_->motor_.current_control_.final_v_alpha;
     V_alpha_beta_memory_[1] = axis_->motor_.current_control_.final_v_beta * axis_->motor_.config_.direction;
 
-    // PLL
-    // TODO: the PLL part has some code duplication with the encoder PLL
-    // Pll gains as a function of bandwidth
-    float pll_kp = 2.0f * config_.pll_bandwidth;
-    // Critically damped
-    float pll_ki = 0.25f * (pll_kp * pll_kp);
+    // PLL (shared observer implementation with the encoder)
     // Check that we don't get problems with discrete time approximation
-    if (!(current_meas_period * pll_kp < 1.0f)) {
+    if (!observer_.set_bandwidth(config_.observer_type, config_.pll_bandwidth)) {
         error_ |= ERROR_UNSTABLE_GAIN;
         return false;
     }
 
-    // predict PLL phase with velocity
-    pll_pos_ = wrap_pm_pi(pll_pos_ + current_meas_period * vel_estimate_);
+    // predict PLL phase with velocity and the torque applied during the last period
+    // (V_beta is mirrored by the motor direction above, so is the current)
+    float Iq = (float)axis_->motor_.config_.direction * axis_->motor_.current_control_.Iq_setpoint;
+    float accel_input = config_.observer_accel_per_amp * Iq;
+    pll_pos_ = wrap_pm_pi(pll_pos_ + observer_.predict(accel_input));
     // update PLL phase with observer permanent magnet phase
     phase_ = fast_atan2(eta[1], eta[0]);
     float delta_phase = wrap_pm_pi(phase_ - pll_pos_);
-    pll_pos_ = wrap_pm_pi(pll_pos_ + current_meas_period * pll_kp * delta_phase);
-    // update PLL velocity
-    vel_estimate_ += current_meas_period * pll_ki * delta_phase;
+    pll_pos_ = wrap_pm_pi(pll_pos_ + observer_.correct(delta_phase));
+    vel_estimate_ = observer_.vel_estimate_;
 
     return true;
 };
@@ -12,6 +12,8 @@ public:
         float observer_gain = 1000.0f; // [rad/s]
         float pll_bandwidth = 1000.0f;  // [rad/s]
         float pm_flux_linkage = 1.58e-3f; // [V / (rad/s)]  { 5.51328895422 / (<pole pairs> * <rpm/v>) }
+        Observer::Type_t observer_type = Observer::TYPE_PLL;
+        float observer_accel_per_amp = 0.0f; // [(rad/s^2) / A] electrical, Iq feed-forward into the observer, 0 to disable
     };
 
     explicit SensorlessEstimator(Config_t& config);
@@ -26,8 +28,7 @@ public:
     float phase_ = 0.0f;                        // [rad]
     float pll_pos_ = 0.0f;                      // [rad]
     float vel_estimate_ = 0.0f;                      // [rad/s]
-    // float pll_kp_ = 0.0f;                       // [rad/s / rad]
-    // float pll_ki_ = 0.0f;                       // [(rad/s^2) / rad]
+    Observer observer_;
     float flux_state_[2] = {0.0f, 0.0f};        // [Vs]
     float V_alpha_beta_memory_[2] = {0.0f, 0.0f}; // [V]
     bool estimator_good_ = false;
@@ -38,13 +39,14 @@ public:
             make_protocol_property("error", &error_),
             make_protocol_property("phase", &phase_),
             make_protocol_property("pll_pos", &pll_pos_),
-            make_protocol_property("vel_estimate", &vel_estimate_),
-            // make_protocol_property("pll_kp", &pll_kp_),
-            // make_protocol_property("pll_ki", &pll_ki_),
+            make_protocol_ro_property("vel_estimate", &vel_estimate_),
+            make_protocol_ro_property("accel_estimate", &observer_.accel_estimate_),
             make_protocol_object("config",
                 make_protocol_property("observer_gain", &config_.observer_gain),
                 make_protocol_property("pll_bandwidth", &config_.pll_bandwidth),
-                make_protocol_property("pm_flux_linkage", &config_.pm_flux_linkage)
+                make_protocol_property("pm_flux_linkage", &config_.pm_flux_linkage),
+                make_protocol_property("observer_type", &config_.observer_type),
+                make_protocol_property("observer_accel_per_amp", &config_.observer_accel_per_amp)
             )
         );
     }
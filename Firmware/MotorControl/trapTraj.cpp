@@ -7,6 +7,10 @@ float sign_hard(float val) {
     return (std::signbit(val)) ? -1.0f : 1.0f;
 }
 
+uint32_t traj_ticks(float t) {
+    return (t > 0.0f) ? (uint32_t)ceilf(t * (float)current_meas_hz) : 0;
+}
+
 // Symbol                     Description
 // Ta, Tv and Td              Duration of the stages of the AL profile
 // Xi and Vi                  Adapted initial conditions for the AL profile
@@ -59,36 +63,115 @@ bool TrapezoidalTrajectory::planTrapezoidal(float Xf, float Xi, float Vi,
     Xf_ = Xf;
     Vi_ = Vi;
     yAccel_ = Xi + Vi*Ta_ + 0.5f*Ar_*SQ(Ta_); // pos at end of accel phase
+    prepare_segments();
+
+    return true;
+}
+
+// @brief Plans a trapezoidal move with given phase durations instead of
+// kinematic limits. This is used to give several axes the same timing.
+bool TrapezoidalTrajectory::planTimed(float Xf, float Xi, float Vi,
+                                      float Ta, float Tv, float Td) {
+    float dX = Xf - Xi;  // Distance to travel
+    float Teff = 0.5f*Ta + Tv + 0.5f*Td; // Duration of a move at cruising speed with the same displacement
+
+    if (Teff > 0.0f) {
+        Vr_ = (dX - 0.5f*Ta*Vi) / Teff;
+        Ar_ = (Ta > 0.0f) ? (Vr_ - Vi) / Ta : 0.0f;
+        Dr_ = (Td > 0.0f) ? -Vr_ / Td : 0.0f;
+    } else {
+        Vr_ = 0.0f;
+        Ar_ = 0.0f;
+        Dr_ = 0.0f;
+    }
+
+    // Fill in the rest of the values used at evaluation-time
+    Ta_ = Ta;
+    Tv_ = Tv;
+    Td_ = Td;
+    Tf_ = Ta_ + Tv_ + Td_;
+    Xi_ = Xi;
+    Xf_ = Xf;
+    Vi_ = Vi;
+    yAccel_ = Xi + Vi*Ta_ + 0.5f*Ar_*SQ(Ta_); // pos at end of accel phase
+    prepare_segments();
 
     return true;
 }
 
-TrapezoidalTrajectory::Step_t TrapezoidalTrajectory::eval(float t) {
+// @brief Replaces the plan with one that was made in a copy of this
+// trajectory. The config is shared and stays as it is.
+void TrapezoidalTrajectory::take_plan(const TrapezoidalTrajectory& plan) {
+    Xi_ = plan.Xi_;
+    Xf_ = plan.Xf_;
+    Vi_ = plan.Vi_;
+    Ar_ = plan.Ar_;
+    Vr_ = plan.Vr_;
+    Dr_ = plan.Dr_;
+    Ta_ = plan.Ta_;
+    Tv_ = plan.Tv_;
+    Td_ = plan.Td_;
+    Tf_ = plan.Tf_;
+    yAccel_ = plan.yAccel_;
+    for (size_t i = 0; i < sizeof(segments_) / sizeof(segments_[0]); ++i)
+        segments_[i] = plan.segments_[i];
+    segment_idx_ = plan.segment_idx_;
+    end_tick_ = plan.end_tick_;
+}
+
+// @brief Converts the planned profile to segments that start on integer
+// control loop ticks, so that eval() only works with times relative to the
+// start of the current segment.
+void TrapezoidalTrajectory::prepare_segments() {
+    uint32_t tick;
+
+    // Accelerating
+    segments_[0] = {0, 0.0f, Xi_, Vi_, Ar_};
+
+    // Coasting
+    tick = traj_ticks(Ta_);
+    segments_[1] = {tick, (float)tick * current_meas_period - Ta_, yAccel_, Vr_, 0.0f};
+
+    // Deceleration, anchored at the final position
+    tick = traj_ticks(Ta_ + Tv_);
+    segments_[2] = {tick, (float)tick * current_meas_period - (Ta_ + Tv_),
+                    Xf_ + 0.5f*Dr_*SQ(Td_), -Dr_*Td_, Dr_};
+
+    end_tick_ = traj_ticks(Tf_);
+    segment_idx_ = 0;
+}
+
+// @brief Evaluates the trajectory at the given control loop tick.
+// The ticks must not decrease, except after replanning.
+// The current segment is only changed at segment boundaries.
+TrapezoidalTrajectory::Step_t TrapezoidalTrajectory::eval(uint32_t tick) {
     Step_t trajStep;
-    if (t < 0.0f) {  // Initial Condition
-        trajStep.Y   = Xi_;
-        trajStep.Yd  = Vi_;
-        trajStep.Ydd = 0.0f;
-    } else if (t < Ta_) {  // Accelerating
-        trajStep.Y   = Xi_ + Vi_*t + 0.5f*Ar_*SQ(t);
-        trajStep.Yd  = Vi_ + Ar_*t;
-        trajStep.Ydd = Ar_;
-    } else if (t < Ta_ + Tv_) {  // Coasting
-        trajStep.Y   = yAccel_ + Vr_*(t - Ta_);
-        trajStep.Yd  = Vr_;
-        trajStep.Ydd = 0.0f;
-    } else if (t < Tf_) {  // Deceleration
-        float td     = t - Tf_;
-        trajStep.Y   = Xf_ + 0.5f*Dr_*SQ(td);
-        trajStep.Yd  = Dr_*td;
-        trajStep.Ydd = Dr_;
-    } else if (t >= Tf_) {  // Final Condition
+    if (tick >= end_tick_) {  // Final Condition
         trajStep.Y   = Xf_;
         trajStep.Yd  = 0.0f;
         trajStep.Ydd = 0.0f;
-    } else {
-        // TODO: report error here
+        return trajStep;
     }
 
+    // A tick before the current segment means the trajectory was replanned
+    if (tick < segments_[segment_idx_].start_tick)
+        segment_idx_ = 0;
+    while (segment_idx_ + 1 < sizeof(segments_) / sizeof(segments_[0]) &&
+           tick >= segments_[segment_idx_ + 1].start_tick)
+        ++segment_idx_;
+
+    const Segment_t& seg = segments_[segment_idx_];
+    uint32_t ticks = tick - seg.start_tick;
+    float Y = seg.Y0, V = seg.V0;
+    if (ticks >> SPLIT_TICKS_LOG2) {
+        float t_hi = (float)(ticks >> SPLIT_TICKS_LOG2) * ((float)(1u << SPLIT_TICKS_LOG2) * current_meas_period);
+        Y += t_hi * (V + 0.5f * seg.A * t_hi);
+        V += seg.A * t_hi;
+        ticks &= (1u << SPLIT_TICKS_LOG2) - 1;
+    }
+    float t = (float)ticks * current_meas_period + seg.t0;
+    trajStep.Y   = Y + t * (V + 0.5f * seg.A * t);
+    trajStep.Yd  = V + seg.A * t;
+    trajStep.Ydd = seg.A;
     return trajStep;
 }
\ No newline at end of file
@@ -1,6 +1,12 @@
 #ifndef _TRAP_TRAJ_H
 #define _TRAP_TRAJ_H
 
+// A sign function where input 0 has positive sign (not 0)
+float sign_hard(float val);
+
+// Index of the first control loop tick at or after time t
+uint32_t traj_ticks(float t);
+
 class TrapezoidalTrajectory {
 public:
     struct Config_t {
@@ -8,6 +14,7 @@ public:
         float accel_limit = 5000.0f; // [count/s^2]
         float decel_limit = 5000.0f; // [count/s^2]
         float A_per_css = 0.0f;      // [A/(count/s^2)]
+        float jerk_limit = 0.0f;     // [count/s^3] 0 for trapezoidal profiles, > 0 for jerk limited S-curve profiles
     };
     
     struct Step_t {
@@ -16,10 +23,28 @@ public:
         float Ydd;
     };
 
+    // In long segments, the time since the segment start is split into a
+    // multiple of 2^SPLIT_TICKS_LOG2 ticks and a remainder, so that both
+    // parts are exactly representable as float.
+    static constexpr uint32_t SPLIT_TICKS_LOG2 = 20;
+
+    // Segment of constant acceleration, evaluated on integer control loop
+    // ticks relative to its first tick
+    struct Segment_t {
+        uint32_t start_tick;
+        float t0;  // [s] time between the segment start and start_tick
+        float Y0;  // [count] state at the segment start
+        float V0;  // [count/s]
+        float A;   // [count/s^2]
+    };
+
     explicit TrapezoidalTrajectory(Config_t& config);
     bool planTrapezoidal(float Xf, float Xi, float Vi,
                          float Vmax, float Amax, float Dmax);
-    Step_t eval(float t);
+    bool planTimed(float Xf, float Xi, float Vi,
+                   float Ta, float Tv, float Td);
+    void take_plan(const TrapezoidalTrajectory& plan);
+    Step_t eval(uint32_t tick);
 
     auto make_protocol_definitions() {
         return make_protocol_member_list(
@@ -27,7 +52,8 @@ public:
                 make_protocol_property("vel_limit", &config_.vel_limit),
                 make_protocol_property("accel_limit", &config_.accel_limit),
                 make_protocol_property("decel_limit", &config_.decel_limit),
-                make_protocol_property("A_per_css", &config_.A_per_css)
+                make_protocol_property("A_per_css", &config_.A_per_css),
+                make_protocol_property("jerk_limit", &config_.jerk_limit)
             )
         );
     }
@@ -49,6 +75,14 @@ public:
     float Tf_;
 
     float yAccel_;
+
+    // accel, coast, decel
+    Segment_t segments_[3];
+    size_t segment_idx_ = 0;
+    uint32_t end_tick_ = 0;
+
+private:
+    void prepare_segments();
 };
 
 #endif
\ No newline at end of file
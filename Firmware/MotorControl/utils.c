@@ -6,7 +6,7 @@
 #include <stm32f4xx_hal.h>
 
 
-int SVM(float alpha, float beta, float* tA, float* tB, float* tC) {
+RAMFUNC int SVM(float alpha, float beta, float* tA, float* tB, float* tC) {
     int Sextant;
 
     if (beta >= 0.0f) {
@@ -65,6 +65,15 @@ extern "C" {
 
 #define SQ(x) ((x) * (x))
 
+/**
+ * @brief Places a function in the .ramfunc section so it executes from SRAM.
+ * The code is copied from flash together with .data at startup. This only
+ * saves the flash wait states on ART accelerator cache misses inside the
+ * marked functions. The vector table, the interrupt entry and dispatch, HAL
+ * calls and the FreeRTOS kernel still execute from flash.
+ */
+#define RAMFUNC __attribute__((section(".ramfunc")))
+
 static const float one_by_sqrt3 = 0.57735026919f;
 static const float two_by_sqrt3 = 1.15470053838f;
 static const float sqrt3_by_2 = 0.86602540378f;
@@ -72,6 +72,15 @@ else
     error("unknown UART protocol "..tup.getconfig("UART_PROTOCOL"))
 end
 
+-- Axis settings
+if tup.getconfig("AXIS_COUNT") == "1" then
+    FLAGS += "-DHW_AXIS_COUNT=1"
+elseif tup.getconfig("AXIS_COUNT") == "2" or tup.getconfig("AXIS_COUNT") == "" then
+    FLAGS += "-DHW_AXIS_COUNT=2"
+else
+    error("unsupported axis count "..tup.getconfig("AXIS_COUNT"))
+end
+
 -- GPIO settings
 if tup.getconfig("STEP_DIR") == "y" then
     if tup.getconfig("UART_PROTOCOL") == "none" then
@@ -165,9 +174,13 @@ build{
         'MotorControl/axis.cpp',
         'MotorControl/motor.cpp',
         'MotorControl/encoder.cpp',
+        'MotorControl/observer.cpp',
         'MotorControl/controller.cpp',
+        'MotorControl/input_shaper.cpp',
+        'MotorControl/biquad.cpp',
         'MotorControl/sensorless_estimator.cpp',
         'MotorControl/trapTraj.cpp',
+        'MotorControl/sCurveTraj.cpp',
         'MotorControl/main.cpp',
         'communication/communication.cpp',
         'communication/ascii_protocol.cpp',
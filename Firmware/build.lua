@@ -99,6 +99,8 @@ function GCCToolchain(prefix, builddir, compiler_flags, linker_flags)
             }
             -- display the size
             tup.frule{inputs={output_name..'.elf'}, command=prefix..'size %f'}
+            -- list the functions that were relocated to RAM (.ramfunc)
+            tup.frule{inputs={output_name..'.elf'}, command=prefix..'nm -C -S --size-sort %f | grep -E "^2[0-9a-f]{7} [0-9a-f]+ [tTwW] " > %o || true', outputs={output_name..'.ramfunc.txt'}}
             -- generate disassembly
             tup.frule{inputs={output_name..'.elf'}, command=prefix..'objdump %f -dSC > %o', outputs={output_name..'.asm'}}
             -- create *.hex and *.bin output formats
@@ -207,11 +207,11 @@ void ASCII_protocol_process_line(const uint8_t* buffer, size_t len, StreamSink&
 
     } else if (cmd[0] == 's'){ // System
         if(cmd[1] == 's') { // Save config
-            save_configuration();
+            respond(response_channel, use_checksum, save_configuration() ? "1" : "0");
         } else if (cmd[1] == 'e'){ // Erase config
-            erase_configuration();
+            respond(response_channel, use_checksum, erase_configuration() ? "1" : "0");
         } else if (cmd[1] == 'b'){ // Reboot
-            NVIC_SystemReset();
+            reboot();
         }
 
     } else if (cmd[0] == 'r') { // read property
@@ -64,6 +64,10 @@ const uint8_t fw_version_revision = FW_VERSION_REVISION;
 const uint8_t fw_version_unreleased = FW_VERSION_UNRELEASED; // 0 for official releases, 1 otherwise
 
 osThreadId comm_thread;
+#define COMM_STACK_SIZE 8000 // [words] TODO: fix stack issues
+__attribute__((section(".ccmram")))
+static uint32_t comm_thread_stack[COMM_STACK_SIZE];
+static osStaticThreadDef_t comm_thread_cb;
 volatile bool endpoint_list_valid = false;
 
 static uint32_t test_property = 0;
@@ -84,7 +88,8 @@ void init_communication(void) {
     printf("hi!\r\n");
 
     // Start command handling thread
-    osThreadDef(task_cmd_parse, communication_task, osPriorityNormal, 0, 8000 /* in 32-bit words */); // TODO: fix stack issues
+    osThreadStaticDef(task_cmd_parse, communication_task, osPriorityNormal, 0, COMM_STACK_SIZE,
+            comm_thread_stack, &comm_thread_cb);
     comm_thread = osThreadCreate(osThread(task_cmd_parse), NULL);
 
     while (!endpoint_list_valid)
@@ -103,13 +108,19 @@ static CAN_context can1_ctx;
 // TODO: make this go away
 class StaticFunctions {
 public:
-    void save_configuration_helper() { save_configuration(); }
-    void erase_configuration_helper() { erase_configuration(); }
-    void NVIC_SystemReset_helper() { NVIC_SystemReset(); }
+    bool save_configuration_helper() { return save_configuration(); }
+    bool erase_configuration_helper() { return erase_configuration(); }
+    void reboot_helper() { reboot(); }
     void enter_dfu_mode_helper() { enter_dfu_mode(); }
     float get_oscilloscope_val(uint32_t index) { return oscilloscope[index]; }
     float get_adc_voltage_(uint32_t gpio) { return get_adc_voltage(get_gpio_port_by_pin(gpio), get_gpio_pin_by_pin(gpio)); }
     int32_t test_function(int32_t delta) { static int cnt = 0; return cnt += delta; }
+#if HW_AXIS_COUNT >= 2
+    bool move_coordinated_helper(float goal_point0, float goal_point1) {
+        const float goal_points[AXIS_COUNT] = {goal_point0, goal_point1};
+        return Controller::move_coordinated(goal_points);
+    }
+#endif
 } static_functions;
 
 // When adding new functions/variables to the protocol, be careful not to
@@ -127,17 +138,22 @@ static inline auto make_obj_tree() {
         make_protocol_ro_property("fw_version_revision", &fw_version_revision),
         make_protocol_ro_property("fw_version_unreleased", &fw_version_unreleased),
         make_protocol_ro_property("user_config_loaded", const_cast<const bool *>(&user_config_loaded_)),
+        make_protocol_ro_property("config_save_pending", const_cast<const bool *>(&config_save_pending_)),
+        make_protocol_ro_property("config_save_deferred", const_cast<const bool *>(&config_save_deferred_)),
         make_protocol_ro_property("brake_resistor_armed", &brake_resistor_armed),
         make_protocol_object("system_stats",
             make_protocol_ro_property("uptime", &system_stats_.uptime),
             make_protocol_ro_property("min_heap_space", &system_stats_.min_heap_space),
-            make_protocol_ro_property("min_stack_space_axis0", &system_stats_.min_stack_space_axis0),
-            make_protocol_ro_property("min_stack_space_axis1", &system_stats_.min_stack_space_axis1),
+            make_protocol_ro_property("min_stack_space_axis0", &system_stats_.min_stack_space_axis[0]),
+#if HW_AXIS_COUNT >= 2
+            make_protocol_ro_property("min_stack_space_axis1", &system_stats_.min_stack_space_axis[1]),
+#endif
             make_protocol_ro_property("min_stack_space_comms", &system_stats_.min_stack_space_comms),
             make_protocol_ro_property("min_stack_space_usb", &system_stats_.min_stack_space_usb),
             make_protocol_ro_property("min_stack_space_uart", &system_stats_.min_stack_space_uart),
             make_protocol_ro_property("min_stack_space_usb_irq", &system_stats_.min_stack_space_usb_irq),
             make_protocol_ro_property("min_stack_space_startup", &system_stats_.min_stack_space_startup),
+            make_protocol_ro_property("min_stack_space_nvm", &system_stats_.min_stack_space_nvm),
             make_protocol_object("usb",
                 make_protocol_ro_property("rx_cnt", &usb_stats_.rx_cnt),
                 make_protocol_ro_property("tx_cnt", &usb_stats_.tx_cnt),
@@ -169,7 +185,10 @@ static inline auto make_obj_tree() {
             make_protocol_object("gpio4_analog_mapping", make_protocol_definitions(board_config.analog_mappings[3]))
             ),
         make_protocol_object("axis0", axes[0]->make_protocol_definitions()),
+#if HW_AXIS_COUNT >= 2
         make_protocol_object("axis1", axes[1]->make_protocol_definitions()),
+        make_protocol_function("move_coordinated", static_functions, &StaticFunctions::move_coordinated_helper, "goal_point0", "goal_point1"),
+#endif
         make_protocol_object("can", can1_ctx.make_protocol_definitions()),
         make_protocol_property("test_property", &test_property),
         make_protocol_function("test_function", static_functions, &StaticFunctions::test_function, "delta"),
@@ -177,7 +196,7 @@ static inline auto make_obj_tree() {
         make_protocol_function("get_adc_voltage", static_functions, &StaticFunctions::get_adc_voltage_, "gpio"),
         make_protocol_function("save_configuration", static_functions, &StaticFunctions::save_configuration_helper),
         make_protocol_function("erase_configuration", static_functions, &StaticFunctions::erase_configuration_helper),
-        make_protocol_function("reboot", static_functions, &StaticFunctions::NVIC_SystemReset_helper),
+        make_protocol_function("reboot", static_functions, &StaticFunctions::reboot_helper),
         make_protocol_function("enter_dfu_mode", static_functions, &StaticFunctions::enter_dfu_mode_helper)
     );
 }
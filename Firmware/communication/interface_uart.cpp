@@ -22,6 +22,10 @@ static uint32_t dma_last_rcv_idx;
 // static thread_local uint32_t deadline_ms = 0;
 
 osThreadId uart_thread;
+#define UART_STACK_SIZE 1024 // [words] the ascii protocol needs considerable stack space
+__attribute__((section(".ccmram")))
+static uint32_t uart_thread_stack[UART_STACK_SIZE];
+static osStaticThreadDef_t uart_thread_cb;
 
 
 class UART4Sender : public StreamSink {
@@ -98,7 +102,8 @@ void start_uart_server() {
     dma_last_rcv_idx = UART_RX_BUFFER_SIZE - huart4.hdmarx->Instance->NDTR;
 
     // Start UART communication thread
-    osThreadDef(uart_server_thread_def, uart_server_thread, osPriorityNormal, 0, 1024 /* the ascii protocol needs considerable stack space */);
+    osThreadStaticDef(uart_server_thread_def, uart_server_thread, osPriorityNormal, 0, UART_STACK_SIZE,
+            uart_thread_stack, &uart_thread_cb);
     uart_thread = osThreadCreate(osThread(uart_server_thread_def), NULL);
 }
 
@@ -14,6 +14,10 @@
 #include <odrive_main.h>
 
 osThreadId usb_thread;
+#define USB_STACK_SIZE 1024 // [words]
+__attribute__((section(".ccmram")))
+static uint32_t usb_thread_stack[USB_STACK_SIZE];
+static osStaticThreadDef_t usb_thread_cb;
 USBStats_t usb_stats_ = {0};
 
 class USBSender : public PacketSink {
@@ -177,6 +181,7 @@ void usb_rx_process_packet(uint8_t *buf, uint32_t len, uint8_t endpoint_pair) {
 
 void start_usb_server() {
     // Start USB communication thread
-    osThreadDef(usb_server_thread_def, usb_server_thread, osPriorityNormal, 0, 1024);
+    osThreadStaticDef(usb_server_thread_def, usb_server_thread, osPriorityNormal, 0, USB_STACK_SIZE,
+            usb_thread_stack, &usb_thread_cb);
     usb_thread = osThreadCreate(osThread(usb_server_thread_def), NULL);
 }
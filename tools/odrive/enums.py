@@ -12,6 +12,9 @@ AXIS_STATE_ENCODER_OFFSET_CALIBRATION = 7
 AXIS_STATE_CLOSED_LOOP_CONTROL = 8
 AXIS_STATE_LOCKIN_SPIN = 9
 AXIS_STATE_ENCODER_DIR_FIND = 10
+AXIS_STATE_ENCODER_SINCOS_CALIBRATION = 11
+AXIS_STATE_AUTOTUNE = 12
+AXIS_STATE_HOMING = 13
 
 class errors:
     class axis:
@@ -28,6 +31,7 @@ class errors:
         ERROR_CONTROLLER_FAILED = 0x200
         ERROR_POS_CTRL_DURING_SENSORLESS = 0x400
         ERROR_WATCHDOG_TIMER_EXPIRED = 0x800
+        ERROR_HOMING_FAILED = 0x1000
 
     class motor:
         ERROR_NONE = 0
@@ -51,10 +55,17 @@ class errors:
         ERROR_UNSUPPORTED_ENCODER_MODE = 0x08
         ERROR_ILLEGAL_HALL_STATE = 0x10
         ERROR_INDEX_NOT_FOUND_YET = 0x20
+        ERROR_SINCOS_CALIBRATION_FAILED = 0x40
+        ERROR_SIGNAL_GLITCHES = 0x80
 
     class controller:
         ERROR_NONE = 0
         ERROR_OVERSPEED = 0x01
+        ERROR_INVALID_LOAD_ENCODER = 0x02
+        ERROR_INVALID_FOLLOW_AXIS = 0x04
+        ERROR_AUTOTUNE_FAILED = 0x08
+        ERROR_AUTOTUNE_TRAVEL_EXCEEDED = 0x10
+        ERROR_ANTICOGGING_MAP_UNAVAILABLE = 0x20
 
 MOTOR_TYPE_HIGH_CURRENT = 0
 #MOTOR_TYPE_LOW_CURRENT = 1
@@ -65,6 +76,29 @@ CTRL_MODE_CURRENT_CONTROL = 1
 CTRL_MODE_VELOCITY_CONTROL = 2
 CTRL_MODE_POSITION_CONTROL = 3
 CTRL_MODE_TRAJECTORY_CONTROL = 4
+CTRL_MODE_PVT_CONTROL = 5
+CTRL_MODE_FOLLOW = 6
+
+FOLLOW_SOURCE_POS_ESTIMATE = 0
+FOLLOW_SOURCE_POS_SETPOINT = 1
+
+INPUT_SHAPER_TYPE_NONE = 0
+INPUT_SHAPER_TYPE_ZV = 1
+INPUT_SHAPER_TYPE_ZVD = 2
+INPUT_SHAPER_TYPE_EI = 3
+
+BIQUAD_TYPE_NONE = 0
+BIQUAD_TYPE_LOWPASS = 1
+BIQUAD_TYPE_NOTCH = 2
+BIQUAD_TYPE_LEAD_LAG = 3
+
+GAIN_SCHEDULE_PARAM_NONE = 0
+GAIN_SCHEDULE_PARAM_LOAD_CURRENT = 1
+GAIN_SCHEDULE_PARAM_USER = 2
 
 ENCODER_MODE_INCREMENTAL = 0
 ENCODER_MODE_HALL = 1
+ENCODER_MODE_SINCOS = 2
+
+OBSERVER_TYPE_PLL = 0
+OBSERVER_TYPE_PVA = 1